@@ -0,0 +1,49 @@
+/* $Id$ */
+
+/* Decode a binstore file without doing anything with it, prints
+   <records> <items> <uncompressed bytes> to measure raw decoding speed. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "binstore.h"
+
+int main(int argc, char ** argv)
+{
+  uint64_t records = 0, items = 0, bytes = 0;
+  const void * ptr;
+  char type;
+  BINSTORE * bs;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <file.pcs>\n", argv[0]);
+    return 2;
+  }
+  if (!(bs = binstore_open(argv[1], "r"))) {
+    fprintf(stderr, "Cannot open %s\n", argv[1]);
+    return 1;
+  }
+
+  for(;;) {
+    uint64_t n = 0;
+    while((type = binstore_load(bs, &ptr))) {
+      ++n;
+      switch(type) {
+        case 'c': bytes += 2; break;
+        case 'i': bytes += 5; break;
+        case 'l': bytes += 9; break;
+        case 's': bytes += 5 + strlen((const char *)ptr) + 1; break;
+        default:  bytes += 1; break;
+      }
+    }
+    if (!n)
+      break;  /* empty record: end of file */
+    items += n;
+    ++records;
+    ++bytes;  /* end of record */
+  }
+
+  printf("%llu %llu %llu\n", (unsigned long long)records, (unsigned long long)items, (unsigned long long)bytes);
+  binstore_close(bs);
+  return 0;
+}
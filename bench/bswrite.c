@@ -0,0 +1,74 @@
+/* $Id$ */
+
+/* Write the same pseudo-random records (all item types, nested sources, records larger than
+   a chunk) once through binstore_store() and once through the typed bs_put_*() writer.
+   pipebench.py --check compares the decompressed files, they must be identical. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "binstore.h"
+
+static uint64_t seed = 1;
+
+static uint32_t rnd(uint32_t n)
+{
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (seed >> 33) % n;
+}
+
+static const char * names[] = { "", "main", "foo(int, char**)", "std::vector<int>::push_back", "[stack]" };
+
+int main(int argc, char ** argv)
+{
+  BINSTORE * bsv, * bst;
+  BINSTORE_RECORD rec;
+  long i, records = 100000;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <varargs.pcs> <typed.pcs> [<records>]\n", argv[0]);
+    return 2;
+  }
+  if (argc > 3)
+    records = atol(argv[3]);
+  if (!(bsv = binstore_open(argv[1], "w")) || !(bst = binstore_open(argv[2], "w"))) {
+    fprintf(stderr, "Cannot open output files\n");
+    return 1;
+  }
+  bs_record_init(&rec);
+
+  for(i = 0; i < records; ++i) {
+    uint32_t a = rnd(1 << 30), b = rnd(64), n, j;
+    uint64_t c = ((uint64_t)rnd(1 << 30) << 32) | rnd(1 << 30);
+    const char * s = names[rnd(sizeof(names) / sizeof(names[0]))];
+    switch(rnd(4)) {
+      case 0:   /* flat record, like 'E' or 'F' */
+        binstore_store(bsv, "ciils", 'E', a, b, c, s);
+        bs_put_char(&rec, 'E'); bs_put_u32(&rec, a); bs_put_u32(&rec, b); bs_put_u64(&rec, c); bs_put_str(&rec, s);
+        bs_end_record(bst, &rec);
+        break;
+      case 3:   /* empty record */
+        binstore_store(bsv, "");
+        bs_end_record(bst, &rec);
+        break;
+      default:  /* record with a variable number of sources, like 'C'; now and then one larger than BINSTORE_CHUNK */
+        n = rnd(1000) ? rnd(8) : 5000 + rnd(5000);
+        binstore_store_items(bsv, "cii", 'C', a, b);
+        bs_put_char(&rec, 'C'); bs_put_u32(&rec, a); bs_put_u32(&rec, b);
+        for(j = 0; j < n; ++j) {
+          uint32_t t = rnd(64);
+          uint64_t v = rnd(1 << 20);
+          binstore_store_items(bsv, "(icl)", t, 'x', v);
+          bs_put_open(&rec); bs_put_u32(&rec, t); bs_put_char(&rec, 'x'); bs_put_u64(&rec, v); bs_put_close(&rec);
+        }
+        binstore_store_end(bsv);
+        bs_end_record(bst, &rec);
+        break;
+    }
+  }
+
+  bs_record_free(&rec);
+  binstore_close(bsv);
+  binstore_close(bst);
+  return 0;
+}
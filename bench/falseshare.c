@@ -0,0 +1,54 @@
+/* $Id$ */
+
+/* False sharing: every thread increments its own counter, all counters share one cache line
+   (or each get their own line when the third argument is 1). */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../pinmagic.h"
+
+#define LINE_SIZE 64
+
+static long iterations;
+static int stride;
+static char * counters;
+
+void * worker(void * arg)
+{
+  long id = (long)arg, i;
+  volatile long * counter = (volatile long *)(counters + id * stride);
+  PIN_REGION(1);
+  for(i = 0; i < iterations; ++i)
+    ++*counter;
+  return NULL;
+}
+
+int main(int argc, char ** argv)
+{
+  int threads = argc > 1 ? atoi(argv[1]) : 4, i;
+  long sum = 0;
+  pthread_t * tids;
+
+  iterations = argc > 2 ? atol(argv[2]) : 1000000;
+  stride = argc > 3 && atoi(argv[3]) ? LINE_SIZE : sizeof(long);
+  tids = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+  if (posix_memalign((void **)&counters, LINE_SIZE, threads * LINE_SIZE))
+    return 1;
+  for(i = 0; i < threads; ++i)
+    *(long *)(counters + i * stride) = 0;
+
+  PIN_ZONE_ENTER(1);
+  for(i = 0; i < threads; ++i)
+    pthread_create(&tids[i], NULL, worker, (void *)(long)i);
+  for(i = 0; i < threads; ++i)
+    pthread_join(tids[i], NULL);
+  PIN_ZONE_EXIT(1);
+
+  for(i = 0; i < threads; ++i)
+    sum += *(long *)(counters + i * stride);
+  printf("falseshare: %d threads, %s, checksum %ld\n", threads, stride == LINE_SIZE ? "padded" : "shared line", sum);
+  free(counters);
+  free(tids);
+  return 0;
+}
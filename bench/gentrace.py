@@ -0,0 +1,183 @@
+#!/usr/bin/python
+# $Id$
+
+# Write a synthetic PinComm trace: a random call tree per thread with E/X/C/M/N/G records
+# in roughly the proportions the pintool produces them, for benchmarking the offline tools.
+
+import sys, os, getopt, random
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+import binstore
+
+threads = 4
+calls = 10000       # function calls per thread
+depth = 8           # maximum call depth
+functions = 50
+regions = 8
+seed = 1
+interval = 0        # write V records every <interval> instructions (like pincomm -interval)
+latency = False     # write H records (like pincomm -latency)
+cache = False       # write K records (like pincomm -cache)
+sync = False        # write B records for a few locks and a barrier (like pincomm -sync)
+numa = False        # write U records for the 4 KiB pages of all malloc()ed blocks (like pincomm -numa 4096)
+fileout = "synthetic.pcs"
+
+
+def usage():
+  print """\
+-o --output   output filename, default is synthetic.pcs
+--threads     number of threads, default is 4
+--calls       function calls per thread, default is 10000
+--depth       maximum call depth, default is 8
+--functions   number of static functions, default is 50
+--regions     number of PIN_REGIONs, default is 8
+--seed        random seed, default is 1
+--interval    write V records every <interval> instructions, default is 0 (off)
+--latency     write H records with write-to-read distance histograms
+--cache       write K records with cache model miss and invalidation counts
+--sync        write B records with per sync object acquires, handoffs and bytes
+--numa        write U records with the first-touching thread and per-region accesses of each page
+"""
+
+
+try:
+  opts, args = getopt.getopt(sys.argv[1:], "ho:",
+    ["help", "output=", "threads=", "calls=", "depth=", "functions=", "regions=", "seed=", "interval=", "latency", "cache", "numa", "sync"])
+except getopt.GetoptError, e:
+  sys.stderr.write("Incorrect option: %s\n" % e)
+  usage()
+  sys.exit(2)
+for o, a in opts:
+  if o in ("-h", "--help"):
+    usage()
+    sys.exit()
+  if o in ("-o", "--output"):
+    fileout = a
+  if o == "--threads":
+    threads = int(a)
+  if o == "--calls":
+    calls = int(a)
+  if o == "--depth":
+    depth = int(a)
+  if o == "--functions":
+    functions = int(a)
+  if o == "--regions":
+    regions = int(a)
+  if o == "--seed":
+    seed = int(a)
+  if o == "--interval":
+    interval = int(a)
+  if o == "--latency":
+    latency = True
+  if o == "--cache":
+    cache = True
+  if o == "--numa":
+    numa = True
+  if o == "--sync":
+    sync = True
+
+
+rnd = random.Random(seed)
+bs = binstore.binstore(fileout)
+
+fids = [ 0x8048000 + 0x100 * f for f in xrange(functions) ]
+sites = [ fid + 0x40 for fid in fids ]
+for f, fid in enumerate(fids):
+  lib = f % 5 == 4
+  bs.store('F', fid, lib and '/lib/libc.so.6' or '/usr/bin/synthetic', 'func%u' % f, lib and '' or 'synthetic.c', lib and 0 or 100 + f)
+for f, site in enumerate(sites):
+  bs.store('A', site, fids[f], 'synthetic.c', 200 + f)
+bs.store('START')
+
+stack = [ [] for t in xrange(threads) ]     # (fid, dfid, region) per frame
+dfid = [ 0 ] * threads
+icount = [ 0 ] * threads
+left = [ calls ] * threads
+recent = []                                 # regions that wrote data recently, (tid, region, dfid)
+live = {}                                   # malloc()ed blocks, address: size
+allocs = []                                 # all malloc()ed blocks, (address, size, site)
+nextaddr = 0x10000000
+imatrix = {}                                # (dst tid, dst region, src tid, src region): bytes
+interval_seq = 0
+interval_next = interval
+
+def enter(t, region):
+  dfid[t] += 1
+  fid = rnd.choice(fids)
+  stack[t].append((fid, dfid[t], region))
+  bs.store('E', t, fid, dfid[t], rnd.choice(sites), icount[t])
+
+def exit(t):
+  fid, d, region = stack[t].pop()
+  sources = []
+  for i in xrange(rnd.randint(0, 4)):
+    if recent:
+      _t, _r, _d = rnd.choice(recent)
+      sources.append((_t, _r, _d, 8 * rnd.randint(1, 512)))
+      if interval:
+        imatrix[(t, region, _t, _r)] = imatrix.get((t, region, _t, _r), 0) + sources[-1][-1]
+  bs.store('C', t, region, d, *sources)
+  if latency and sources:
+    bs.store('H', t, region, d, *[ (_t, _r, _d, rnd.randint(4, 20), size) for _t, _r, _d, size in sources ])
+  if cache and sources:
+    bs.store('K', t, region, d, *[ (_t, _r, _d, size / 64, rnd.randint(0, 8), rnd.randint(0, 2), rnd.randint(0, 8)) for _t, _r, _d, size in sources ])
+  bs.store('X', t, icount[t], 0)
+  recent.append((t, region, d))
+  if len(recent) > 256:
+    del recent[:128]
+
+while sum(left):
+  if interval and sum(icount) >= interval_next:
+    bs.store('V', interval_seq, sum(icount), *[ k + (v,) for k, v in sorted(imatrix.items()) ])
+    imatrix = {}
+    interval_seq += 1
+    interval_next += interval
+  t = rnd.choice([ t for t in xrange(threads) if left[t] or stack[t] ])
+  icount[t] += rnd.randint(1, 2000)
+  region = stack[t] and stack[t][-1][2] or 0
+  r = rnd.random()
+  if not stack[t] or (left[t] and len(stack[t]) < depth and r < 0.55):
+    if left[t]:
+      left[t] -= 1
+      enter(t, region)
+    else:
+      continue
+  else:
+    exit(t)
+  if stack[t] and rnd.random() < 0.02:
+    fid, d, region = stack[t][-1]
+    region = rnd.randint(1, regions)
+    stack[t][-1] = (fid, d, region)
+    bs.store('G', t, region, icount[t])
+  if rnd.random() < 0.05:
+    size = rnd.choice((16, 64, 256, 4096, 65536))
+    live[nextaddr] = size
+    site = rnd.choice(sites)
+    allocs.append((nextaddr, size, site))
+    bs.store('M', t, 0, site, nextaddr, size)
+    nextaddr += size
+  if live and rnd.random() < 0.045:
+    addr = rnd.choice(live.keys())
+    del live[addr]
+    bs.store('N', t, addr)
+
+for t in xrange(threads):
+  while stack[t]:
+    exit(t)
+  bs.store('I', t, icount[t])
+if interval:
+  bs.store('V', interval_seq, sum(icount), *[ k + (v,) for k, v in sorted(imatrix.items()) ])
+if numa:
+  pages = {}
+  for addr, size, site in allocs:
+    for page in xrange(addr >> 12, (addr + size - 1 >> 12) + 1):
+      pages.setdefault(page, site)
+  for page, site in sorted(pages.items()):
+    first = rnd.randrange(threads)
+    users = rnd.sample(xrange(threads), rnd.randint(1, threads))
+    bs.store('U', page << 12, first, 0, site, *[ (t, rnd.randint(0, regions), 8 * rnd.randint(0, 512), 8 * rnd.randint(0, 128)) for t in users ])
+if sync:
+  for i, kind in enumerate((0, 0, 0, 1, 2)):
+    acquires = rnd.randint(1, 1000)
+    bs.store('B', 0x8049000 + 64 * i, kind, acquires, rnd.randint(0, acquires), 64 * rnd.randint(0, acquires), 8 * rnd.randint(0, 100 * acquires))
+bs.store('STOP')
+bs.store('END')
@@ -0,0 +1,90 @@
+/* $Id$ */
+
+/* Malloc-heavy: every thread keeps a pool of live blocks that it keeps replacing with
+   malloc/calloc/realloc/free, and hands some blocks to the next thread to free. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../pinmagic.h"
+
+#define POOL_SIZE 256
+#define MAX_BLOCK 4096
+
+static int threads;
+static long operations;
+static void ** handoff;   /* one slot per thread, filled by the previous thread */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void * worker(void * arg)
+{
+  long id = (long)arg, i;
+  unsigned int seed = id + 1;
+  void * pool[POOL_SIZE] = { NULL };
+  long sum = 0;
+
+  PIN_REGION(1);
+  for(i = 0; i < operations; ++i) {
+    int slot = rand_r(&seed) % POOL_SIZE;
+    size_t size = 1 + rand_r(&seed) % MAX_BLOCK;
+    switch(rand_r(&seed) % 4) {
+      case 0:
+        free(pool[slot]);
+        pool[slot] = malloc(size);
+        break;
+      case 1:
+        free(pool[slot]);
+        pool[slot] = calloc(1, size);
+        break;
+      case 2:
+        pool[slot] = realloc(pool[slot], size);
+        break;
+      case 3:
+        /* pass this block on to the next thread, free whatever we were handed */
+        pthread_mutex_lock(&lock);
+        free(handoff[id]);
+        handoff[id] = NULL;
+        if (!handoff[(id + 1) % threads]) {
+          handoff[(id + 1) % threads] = pool[slot];
+          pool[slot] = NULL;
+        }
+        pthread_mutex_unlock(&lock);
+        continue;
+    }
+    memset(pool[slot], (int)i, size);
+    sum += ((char *)pool[slot])[size - 1];
+  }
+  for(i = 0; i < POOL_SIZE; ++i)
+    free(pool[i]);
+  return (void *)sum;
+}
+
+int main(int argc, char ** argv)
+{
+  int i;
+  long sum = 0;
+  void * ret;
+  pthread_t * tids;
+
+  threads = argc > 1 ? atoi(argv[1]) : 4;
+  operations = argc > 2 ? atol(argv[2]) : 100000;
+  tids = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+  handoff = (void **)calloc(threads, sizeof(void *));
+
+  PIN_ZONE_ENTER(1);
+  for(i = 0; i < threads; ++i)
+    pthread_create(&tids[i], NULL, worker, (void *)(long)i);
+  for(i = 0; i < threads; ++i) {
+    pthread_join(tids[i], &ret);
+    sum += (long)ret;
+  }
+  PIN_ZONE_EXIT(1);
+
+  for(i = 0; i < threads; ++i)
+    free(handoff[i]);
+  printf("mallocheavy: %d threads, %ld operations each, checksum %ld\n", threads, operations, sum);
+  free(handoff);
+  free(tids);
+  return 0;
+}
@@ -0,0 +1,161 @@
+#!/usr/bin/python
+# $Id$
+
+# Measure throughput of the offline pipeline on a synthetic trace: raw binstore decoding,
+# iterating over the records from Python, and pinprocess.py for each --groupby mode.
+# With --check, pinprocess.py output for the golden trace is compared against bench/golden/,
+# and the typed binstore writer against binstore_store().
+
+import sys, os, time, getopt, subprocess, tempfile, shutil, gzip
+
+benchdir = os.path.dirname(os.path.abspath(__file__))
+rootdir = os.path.dirname(benchdir)
+sys.path.insert(0, rootdir)
+import binstore
+
+modes = ['tf', 'ts', 's', 'tr', 'r', 't', 'tt:100000']
+golden_trace = ['--threads', '4', '--calls', '200', '--seed', '1']
+goldendir = os.path.join(benchdir, 'golden')
+
+trace = None
+genargs = []
+groupby = []
+check = False
+update = False
+
+
+def usage():
+  print """\
+-i --input      use this trace instead of generating one
+--threads       --calls --depth --functions --regions --seed: passed to gentrace.py
+--groupby       only time this --groupby mode (can be repeated), default is all of them
+--check         compare pinprocess.py output on the golden trace with bench/golden/,
+                and bs_put_*() output with binstore_store()
+--update-golden regenerate bench/golden/ with the current pinprocess.py
+"""
+
+
+def python():
+  return sys.executable or 'python'
+
+def gentrace(filename, args):
+  subprocess.check_call([python(), os.path.join(benchdir, 'gentrace.py'), '-o', filename] + args)
+
+def pinprocess(filein, fileout, mode, args = []):
+  start = time.time()
+  subprocess.check_call([python(), os.path.join(rootdir, 'pinprocess.py'), '-i', filein, '-o', fileout, '--groupby', mode] + args,
+    stdout = open(os.devnull, 'w'))
+  return time.time() - start
+
+def goldenName(mode):
+  return os.path.join(goldendir, mode.replace(':', '_') + '.csv')
+
+
+try:
+  opts, args = getopt.getopt(sys.argv[1:], "hi:",
+    ["help", "input=", "threads=", "calls=", "depth=", "functions=", "regions=", "seed=", "groupby=", "check", "update-golden"])
+except getopt.GetoptError, e:
+  sys.stderr.write("Incorrect option: %s\n" % e)
+  usage()
+  sys.exit(2)
+for o, a in opts:
+  if o in ("-h", "--help"):
+    usage()
+    sys.exit()
+  if o in ("-i", "--input"):
+    trace = a
+  if o in ("--threads", "--calls", "--depth", "--functions", "--regions", "--seed"):
+    genargs += [o, a]
+  if o == "--groupby":
+    groupby.append(a)
+  if o == "--check":
+    check = True
+  if o == "--update-golden":
+    update = True
+
+tmpdir = tempfile.mkdtemp(prefix = 'pipebench')
+try:
+
+  if check or update:
+    filein = os.path.join(tmpdir, 'golden.pcs')
+    gentrace(filein, golden_trace)
+    if update and not os.path.exists(goldendir):
+      os.mkdir(goldendir)
+    failed = 0
+    def compare(fileout, mode, label = ''):
+      # pinprocess.py makes no promises about row order, so compare sorted rows
+      if sorted(open(fileout)) != sorted(open(goldenName(mode))):
+        print '%-10s FAILED: %soutput differs from %s' % (mode, label and label + ' ', goldenName(mode))
+        return 1
+      print '%-10s ok%s' % (mode, label and ' (%s)' % label)
+      return 0
+    for mode in modes:
+      fileout = os.path.join(tmpdir, 'out.csv')
+      pinprocess(filein, fileout, mode)
+      if update:
+        shutil.copy(fileout, goldenName(mode))
+        continue
+      failed += compare(fileout, mode)
+      # a tiny --membudget makes every table spill to disk several times, the output must not change
+      pinprocess(filein, fileout, mode, ['--membudget', '0.05'])
+      failed += compare(fileout, mode, '--membudget')
+    # all modes in a single pass, each view must write the same as a pass of its own
+    for args in ([], ['--membudget', '0.05']):
+      if update:
+        break
+      pinprocess(filein, os.path.join(tmpdir, 'all.csv'), ','.join(modes), args)
+      for mode in modes:
+        failed += compare(os.path.join(tmpdir, 'all.%s.csv' % mode.replace(':', '_')), mode, ' '.join(['one pass'] + args))
+    # the typed bs_put_*() writer must produce the same bytes as binstore_store()
+    if not update:
+      filevarargs, filetyped = os.path.join(tmpdir, 'varargs.pcs'), os.path.join(tmpdir, 'typed.pcs')
+      subprocess.check_call(['make', '-C', benchdir, 'bswrite'], stdout = open(os.devnull, 'w'))
+      subprocess.check_call([os.path.join(benchdir, 'bswrite'), filevarargs, filetyped])
+      if gzip.open(filevarargs).read() != gzip.open(filetyped).read():
+        print '%-10s FAILED: bs_put_*() output differs from binstore_store()' % 'binstore'
+        failed += 1
+      else:
+        print '%-10s ok (bs_put_*)' % 'binstore'
+    # a --save file read back in must give the same output as the trace it was saved from
+    if not update:
+      filesaved = os.path.join(tmpdir, 'golden.saved')
+      pinprocess(filein, os.path.join(tmpdir, 'out.csv'), modes[0], ['--save', filesaved])
+      for mode in modes:
+        pinprocess(filesaved, os.path.join(tmpdir, 'out.csv'), mode)
+        failed += compare(os.path.join(tmpdir, 'out.csv'), mode, '--save')
+    if check and failed:
+      sys.exit(1)
+    sys.exit(0)
+
+  if not trace:
+    trace = os.path.join(tmpdir, 'synthetic.pcs')
+    gentrace(trace, genargs)
+  size = os.path.getsize(trace)
+
+  decoder = os.path.join(benchdir, 'bsdecode')
+  if not os.path.exists(decoder):
+    subprocess.check_call(['make', '-C', benchdir, 'bsdecode'], stdout = open(os.devnull, 'w'))
+  start = time.time()
+  p = subprocess.Popen([decoder, trace], stdout = subprocess.PIPE)
+  records, items, bytes = map(long, p.communicate()[0].split())
+  elapsed = time.time() - start
+  print 'trace: %s, %u records, %u items, %.1f MB (%.1f MB compressed)' % (trace, records, items, bytes / 1e6, size / 1e6)
+
+  def report(stage, elapsed):
+    print '%-22s %8.3f s %12.0f records/s %8.2f MB/s' % (stage, elapsed, records / elapsed, bytes / 1e6 / elapsed)
+
+  report('decode (C)', elapsed)
+
+  start = time.time()
+  n = 0
+  for record in binstore.binload(trace):
+    n += 1
+  report('iterate (Python)', time.time() - start)
+  if n != records:
+    sys.stderr.write('Warning: binload returned %u records, bsdecode %u\n' % (n, records))
+
+  for mode in groupby or modes:
+    report('pinprocess %s' % mode, pinprocess(trace, os.path.join(tmpdir, 'out.csv'), mode))
+
+finally:
+  shutil.rmtree(tmpdir)
@@ -0,0 +1,93 @@
+/* $Id$ */
+
+/* Pipeline: <threads> stages connected by single-slot buffers, each stage transforms a
+   block of data and passes it on to the next one. Stage <n> is marked as region <n>+1. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../pinmagic.h"
+
+#define BLOCK_SIZE 1024
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  int full;
+  int data[BLOCK_SIZE];
+} slot_t;
+
+static int stages, blocks;
+static slot_t * slots;   /* slots[n] sits between stage n and n+1 */
+static long checksum = 0;
+
+void * stage(void * arg)
+{
+  long id = (long)arg;
+  int b, i, block[BLOCK_SIZE];
+  PIN_REGION((int)id + 1);
+  for(b = 0; b < blocks; ++b) {
+    if (id == 0) {
+      for(i = 0; i < BLOCK_SIZE; ++i)
+        block[i] = b * BLOCK_SIZE + i;
+    } else {
+      slot_t * in = &slots[id - 1];
+      pthread_mutex_lock(&in->lock);
+      while(!in->full)
+        pthread_cond_wait(&in->changed, &in->lock);
+      for(i = 0; i < BLOCK_SIZE; ++i)
+        block[i] = in->data[i];
+      in->full = 0;
+      pthread_cond_signal(&in->changed);
+      pthread_mutex_unlock(&in->lock);
+    }
+
+    for(i = 0; i < BLOCK_SIZE; ++i)
+      block[i] = block[i] * 3 + id;
+
+    if (id == stages - 1) {
+      for(i = 0; i < BLOCK_SIZE; ++i)
+        checksum += block[i];
+    } else {
+      slot_t * out = &slots[id];
+      pthread_mutex_lock(&out->lock);
+      while(out->full)
+        pthread_cond_wait(&out->changed, &out->lock);
+      for(i = 0; i < BLOCK_SIZE; ++i)
+        out->data[i] = block[i];
+      out->full = 1;
+      pthread_cond_signal(&out->changed);
+      pthread_mutex_unlock(&out->lock);
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char ** argv)
+{
+  int i;
+  pthread_t * tids;
+
+  stages = argc > 1 ? atoi(argv[1]) : 4;
+  if (stages < 2)
+    stages = 2;
+  blocks = argc > 2 ? atoi(argv[2]) : 10000;
+  tids = (pthread_t *)malloc(sizeof(pthread_t) * stages);
+  slots = (slot_t *)calloc(stages, sizeof(slot_t));
+  for(i = 0; i < stages; ++i) {
+    pthread_mutex_init(&slots[i].lock, NULL);
+    pthread_cond_init(&slots[i].changed, NULL);
+  }
+
+  PIN_ZONE_ENTER(1);
+  for(i = 0; i < stages; ++i)
+    pthread_create(&tids[i], NULL, stage, (void *)(long)i);
+  for(i = 0; i < stages; ++i)
+    pthread_join(tids[i], NULL);
+  PIN_ZONE_EXIT(1);
+
+  printf("pipeline: %d stages, %d blocks, checksum %ld\n", stages, blocks, checksum);
+  free(slots);
+  free(tids);
+  return 0;
+}
@@ -0,0 +1,96 @@
+/* $Id$ */
+
+/* Producer-consumer: <threads>/2 producers hand items to <threads>/2 consumers
+   through a single bounded queue protected by a mutex and two condition variables. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../pinmagic.h"
+
+#define QUEUE_SIZE 64
+#define ITEM_SIZE 16
+
+typedef struct {
+  int data[ITEM_SIZE];
+} item_t;
+
+static item_t queue[QUEUE_SIZE];
+static int head = 0, tail = 0, count = 0;
+static long items, left;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notfull = PTHREAD_COND_INITIALIZER, notempty = PTHREAD_COND_INITIALIZER;
+
+void * producer(void * arg)
+{
+  long id = (long)arg, i;
+  int j;
+  PIN_REGION(1);
+  for(i = 0; i < items; ++i) {
+    pthread_mutex_lock(&lock);
+    while(count == QUEUE_SIZE)
+      pthread_cond_wait(&notfull, &lock);
+    for(j = 0; j < ITEM_SIZE; ++j)
+      queue[tail].data[j] = id * items + i + j;
+    tail = (tail + 1) % QUEUE_SIZE;
+    ++count;
+    pthread_cond_signal(&notempty);
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+void * consumer(void * arg)
+{
+  long sum = 0;
+  int j;
+  item_t item;
+  PIN_REGION(2);
+  for(;;) {
+    pthread_mutex_lock(&lock);
+    while(count == 0 && left > 0)
+      pthread_cond_wait(&notempty, &lock);
+    if (left == 0) {
+      pthread_mutex_unlock(&lock);
+      break;
+    }
+    item = queue[head];
+    head = (head + 1) % QUEUE_SIZE;
+    --count;
+    if (--left == 0)
+      pthread_cond_broadcast(&notempty);
+    pthread_cond_signal(&notfull);
+    pthread_mutex_unlock(&lock);
+    for(j = 0; j < ITEM_SIZE; ++j)
+      sum += item.data[j];
+  }
+  return (void *)sum;
+}
+
+int main(int argc, char ** argv)
+{
+  int threads = argc > 1 ? atoi(argv[1]) : 4, producers = threads / 2 > 0 ? threads / 2 : 1, i;
+  long sum = 0;
+  void * ret;
+  pthread_t * tids;
+
+  items = argc > 2 ? atol(argv[2]) : 100000;
+  left = items * producers;
+  tids = (pthread_t *)malloc(sizeof(pthread_t) * (producers * 2));
+
+  PIN_ZONE_ENTER(1);
+  for(i = 0; i < producers; ++i) {
+    pthread_create(&tids[i], NULL, producer, (void *)(long)i);
+    pthread_create(&tids[producers + i], NULL, consumer, NULL);
+  }
+  for(i = 0; i < producers * 2; ++i) {
+    pthread_join(tids[i], &ret);
+    if (i >= producers)
+      sum += (long)ret;
+  }
+  PIN_ZONE_EXIT(1);
+
+  printf("prodcons: %d producers, %ld items each, checksum %ld\n", producers, items, sum);
+  free(tids);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/* $Id$ */
+
+/* Synthetic producer for pincommring: starts the analyzer, pushes a known access pattern into the
+   shared memory rings from several threads, and checks the CSV it writes. In each round every thread
+   writes its own block, then reads the block of the next thread, so region <t+1> should have read
+   <rounds * block> bytes from region <(t+1) % threads + 1>. Prints the producer's events/s. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "../shmring.h"
+
+#define BASE 0x10000000
+#define ACCESS 8
+
+static SHMRING * sr;
+static pthread_barrier_t barrier;
+static int threads = 4, rounds = 100;
+static uint64_t block = 65536;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void * worker(void * arg)
+{
+  uint32_t tid = (uintptr_t)arg, next = (tid + 1) % threads;
+  uint64_t region = (uint64_t)(tid + 1) << 10 | tid, a;
+  int r;
+  for(r = 0; r < rounds; ++r) {
+    for(a = 0; a < block; a += ACCESS)
+      shmring_push(sr, tid, BASE + tid * block + a, ACCESS, SHMRING_WRITE, region);
+    pthread_barrier_wait(&barrier);
+    for(a = 0; a < block; a += ACCESS)
+      shmring_push(sr, tid, BASE + next * block + a, ACCESS, SHMRING_READ, region);
+    pthread_barrier_wait(&barrier);
+  }
+  return NULL;
+}
+
+int main(int argc, char ** argv)
+{
+  char filename[64], nrings[16];
+  const char * csv = "ringbench.csv";
+  pthread_t * tids;
+  double start, elapsed;
+  uint64_t events;
+  unsigned src, dst;
+  uint64_t bytes;
+  int i, status, errors = 0, rows = 0;
+  pid_t pid;
+  FILE * fp;
+
+  if (argc < 2 || argc > 5) {
+    fprintf(stderr, "usage: %s <pincommring> [<threads> [<rounds> [<block bytes>]]]\n", argv[0]);
+    return 2;
+  }
+  if (argc > 2) threads = atoi(argv[2]);
+  if (argc > 3) rounds = atoi(argv[3]);
+  if (argc > 4) block = strtoull(argv[4], NULL, 0);
+
+  sprintf(filename, "/dev/shm/ringbench.%d", (int)getpid());
+  sprintf(nrings, "%d", threads);
+  unlink(filename);
+  if (!(pid = fork())) {
+    /* small rings, so back-pressure is exercised */
+    execl(argv[1], argv[1], "-r", filename, "-n", nrings, "-e", "4096", "-o", csv, (char *)NULL);
+    perror(argv[1]);
+    exit(1);
+  }
+  while(!(sr = shmring_open(filename))) {
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+      fprintf(stderr, "pincommring exited before creating %s\n", filename);
+      return 1;
+    }
+    usleep(10000);
+  }
+  sr->hdr->memgran_bits = 6;
+  sr->hdr->attached = 1;
+
+  pthread_barrier_init(&barrier, NULL, threads);
+  tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  start = now();
+  for(i = 0; i < threads; ++i)
+    pthread_create(&tids[i], NULL, worker, (void *)(uintptr_t)i);
+  for(i = 0; i < threads; ++i)
+    pthread_join(tids[i], NULL);
+  elapsed = now() - start;
+  for(events = 0, i = 0; i < threads; ++i)
+    events += shmring_ring(sr, i)->head;
+  sr->hdr->done = 1;
+  shmring_close(sr);
+  waitpid(pid, &status, 0);
+  printf("%d threads, %" PRIu64 " events in %.2f s, %.0f events/s\n", threads, events, elapsed, events / elapsed);
+
+  if (!(fp = fopen(csv, "r"))) {
+    fprintf(stderr, "pincommring didn't write %s\n", csv);
+    return 1;
+  }
+  while(fscanf(fp, "%u,%u,%" SCNu64 "\n", &src, &dst, &bytes) == 3) {
+    ++rows;
+    if (dst < 1 || dst > (unsigned)threads || src != dst % threads + 1 || bytes != rounds * block) {
+      fprintf(stderr, "unexpected row %u,%u,%" PRIu64 "\n", src, dst, bytes);
+      ++errors;
+    }
+  }
+  fclose(fp);
+  unlink(csv);
+  if (rows != threads) {
+    fprintf(stderr, "expected %d rows, got %d\n", threads, rows);
+    ++errors;
+  }
+  printf(errors ? "MISMATCH\n" : "ok\n");
+  return errors ? 1 : 0;
+}
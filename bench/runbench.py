@@ -0,0 +1,120 @@
+#!/usr/bin/python
+# $Id$
+
+# Run the benchmark programs natively and under PinComm, and append slowdown, peak memory,
+# trace size and pinprocess.py time of each of them to a CSV file.
+
+import sys, os, time, getopt, subprocess, tempfile, shutil, csv
+
+benchdir = os.path.dirname(os.path.abspath(__file__))
+rootdir = os.path.dirname(benchdir)
+
+benchmarks = [
+  ('prodcons',    ['4', '100000']),
+  ('stencil',     ['4', '65536', '100']),
+  ('pipeline',    ['4', '10000']),
+  ('falseshare',  ['4', '1000000']),
+  ('mallocheavy', ['4', '100000']),
+]
+
+columns = ['date', 'revision', 'benchmark', 'args', 'native_s', 'pin_s', 'slowdown',
+           'native_rss_kb', 'pin_rss_kb', 'trace_bytes', 'process_s']
+
+pin = None
+tool = None
+pinargs = []
+groupby = 'tr'
+fileresults = os.path.join(benchdir, 'results.csv')
+only = []
+
+
+def usage():
+  print """\
+--pin         path to the pin executable (required)
+--tool        path to pincomm.so (required)
+--pinargs     extra options for pincomm, e.g. "-memgran 8"
+--groupby     --groupby used when timing pinprocess.py, default is tr
+--results     CSV file to append results to, default is bench/results.csv
+--only        only run this benchmark (can be repeated)
+"""
+
+
+def run(cmd, **kwds):
+  """Run <cmd>, returns (wall clock seconds, peak RSS in KiB)"""
+  start = time.time()
+  p = subprocess.Popen(cmd, **kwds)
+  pid, status, rusage = os.wait4(p.pid, 0)
+  elapsed = time.time() - start
+  if status:
+    raise RuntimeError("%s failed with status %d" % (' '.join(cmd), status))
+  return elapsed, rusage.ru_maxrss
+
+
+def revision():
+  try:
+    p = subprocess.Popen(['git', 'rev-parse', '--short', 'HEAD'], cwd = rootdir, stdout = subprocess.PIPE, stderr = open(os.devnull, 'w'))
+    return p.communicate()[0].strip() or 'unknown'
+  except OSError:
+    return 'unknown'
+
+
+try:
+  opts, args = getopt.getopt(sys.argv[1:], "h", ["help", "pin=", "tool=", "pinargs=", "groupby=", "results=", "only="])
+except getopt.GetoptError, e:
+  sys.stderr.write("Incorrect option: %s\n" % e)
+  usage()
+  sys.exit(2)
+for o, a in opts:
+  if o in ("-h", "--help"):
+    usage()
+    sys.exit()
+  if o == "--pin":
+    pin = a
+  if o == "--tool":
+    tool = a
+  if o == "--pinargs":
+    pinargs = a.split()
+  if o == "--groupby":
+    groupby = a
+  if o == "--results":
+    fileresults = a
+  if o == "--only":
+    only.append(a)
+
+if not pin or not tool:
+  usage()
+  sys.exit(2)
+
+
+env = dict(os.environ)
+env['PYTHONPATH'] = os.pathsep.join([rootdir] + filter(None, [env.get('PYTHONPATH')]))
+devnull = open(os.devnull, 'w')
+tmpdir = tempfile.mkdtemp(prefix = 'pincommbench')
+date = time.strftime('%Y-%m-%d %H:%M:%S')
+rev = revision()
+
+newfile = not os.path.exists(fileresults)
+out = csv.writer(open(fileresults, 'a'))
+if newfile:
+  out.writerow(columns)
+
+try:
+  for name, bargs in benchmarks:
+    if only and name not in only:
+      continue
+    exe = os.path.join(benchdir, name)
+    trace = os.path.join(tmpdir, name + '.pcs')
+
+    native_s, native_rss = run([exe] + bargs, stdout = devnull)
+    pin_s, pin_rss = run([pin, '-t', tool, '-o', trace] + pinargs + ['--', exe] + bargs, stdout = devnull)
+    process_s, process_rss = run([sys.executable, os.path.join(rootdir, 'pinprocess.py'), '-i', trace, '-o', os.devnull, '--groupby', groupby],
+                                 stdout = devnull, env = env)
+
+    row = [date, rev, name, ' '.join(bargs), '%.3f' % native_s, '%.3f' % pin_s, '%.1f' % (pin_s / max(native_s, 1e-3)),
+           native_rss, pin_rss, os.path.getsize(trace), '%.3f' % process_s]
+    out.writerow(row)
+    print '%-12s slowdown %7sx  pin %8.1fs  rss %8u KiB  trace %10u bytes  pinprocess %7.1fs' % \
+      (name, row[6], pin_s, pin_rss, row[9], process_s)
+    os.unlink(trace)
+finally:
+  shutil.rmtree(tmpdir)
@@ -0,0 +1,60 @@
+/* $Id$ */
+
+/* Barrier stencil: a 1D Jacobi relaxation, each thread updates its own block of the grid
+   and reads the edges of its neighbours' blocks after every barrier. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../pinmagic.h"
+
+static int threads, size, iterations;
+static double * grid[2];
+static pthread_barrier_t barrier;
+
+void * worker(void * arg)
+{
+  long id = (long)arg;
+  int start = 1 + id * (size - 2) / threads, end = 1 + (id + 1) * (size - 2) / threads, it, i;
+  for(it = 0; it < iterations; ++it) {
+    double * from = grid[it % 2], * to = grid[(it + 1) % 2];
+    PIN_REGION(1);
+    for(i = start; i < end; ++i)
+      to[i] = (from[i - 1] + from[i] + from[i + 1]) / 3.;
+    PIN_REGION(2);
+    pthread_barrier_wait(&barrier);
+  }
+  return NULL;
+}
+
+int main(int argc, char ** argv)
+{
+  int i;
+  double sum = 0;
+  pthread_t * tids;
+
+  threads = argc > 1 ? atoi(argv[1]) : 4;
+  size = argc > 2 ? atoi(argv[2]) : 65536;
+  iterations = argc > 3 ? atoi(argv[3]) : 100;
+  tids = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+  for(i = 0; i < 2; ++i)
+    grid[i] = (double *)calloc(size, sizeof(double));
+  grid[0][0] = grid[1][0] = 1000.;
+  pthread_barrier_init(&barrier, NULL, threads);
+
+  PIN_ZONE_ENTER(1);
+  for(i = 0; i < threads; ++i)
+    pthread_create(&tids[i], NULL, worker, (void *)(long)i);
+  for(i = 0; i < threads; ++i)
+    pthread_join(tids[i], NULL);
+  PIN_ZONE_EXIT(1);
+
+  for(i = 0; i < size; ++i)
+    sum += grid[iterations % 2][i];
+  printf("stencil: %d threads, %d cells, %d iterations, checksum %f\n", threads, size, iterations, sum);
+  pthread_barrier_destroy(&barrier);
+  free(grid[0]);
+  free(grid[1]);
+  free(tids);
+  return 0;
+}
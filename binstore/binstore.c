@@ -28,6 +28,9 @@ BINSTORE * binstore_open(const char * filename, const char * mode)
     if (!bs->fp) return NULL;
     bs->gz = gzdopen(fileno(bs->fp), "w9");
     bs->nesting = 0;
+    bs->bytes = 0;
+    bs->chunk = (char *)malloc(BINSTORE_CHUNK);
+    bs->chunk_used = 0;
 
   } else if (mode[0] == 'r') {
     if (mode[1] == 'p')
@@ -36,6 +39,7 @@ BINSTORE * binstore_open(const char * filename, const char * mode)
       bs->fp = fopen(filename, "rb");
     if (!bs->fp) return NULL;
     bs->gz = gzdopen(fileno(bs->fp), "r");
+    bs->chunk = NULL;
     #define BUFFER_INITIAL 1048576
     bs->buffer = malloc(BUFFER_INITIAL);
     bs->buffer_size = BUFFER_INITIAL;
@@ -47,8 +51,19 @@ BINSTORE * binstore_open(const char * filename, const char * mode)
   return bs;
 }
 
+static void binstore_flush(BINSTORE * bs)
+{
+  if (bs->chunk_used)
+    gzwrite(bs->gz, bs->chunk, bs->chunk_used);
+  bs->chunk_used = 0;
+}
+
 void binstore_close(BINSTORE * bs)
 {
+  if (bs->chunk) {
+    binstore_flush(bs);
+    free(bs->chunk);
+  }
   gzclose(bs->gz);
   fclose(bs->fp);
   free(bs);
@@ -56,7 +71,26 @@ void binstore_close(BINSTORE * bs)
 
 size_t binstore_write(BINSTORE * bs, const void * data, size_t size)
 {
-  return gzwrite(bs->gz, data, size);
+  bs->bytes += size;
+  if (bs->chunk_used + size > BINSTORE_CHUNK) {
+    binstore_flush(bs);
+    if (size > BINSTORE_CHUNK)
+      return gzwrite(bs->gz, data, size);
+  }
+  memcpy(bs->chunk + bs->chunk_used, data, size);
+  bs->chunk_used += size;
+  return size;
+}
+
+/* bytes written so far, before and after compression (0 if zlib can't tell us) */
+void binstore_stats(BINSTORE * bs, uint64_t * bytes, uint64_t * bytes_compressed)
+{
+  *bytes = bs->bytes;
+#if ZLIB_VERNUM >= 0x1240
+  *bytes_compressed = gzoffset(bs->gz);
+#else
+  *bytes_compressed = 0;
+#endif
 }
 
 void __binstore_store_items(BINSTORE * bs, const char * types, va_list args);
@@ -128,6 +162,37 @@ void binstore_store_end(BINSTORE * bs)
 }
 
 
+void bs_record_init(BINSTORE_RECORD * r)
+{
+  r->data = NULL;
+  r->used = r->size = 0;
+  r->nesting = 0;
+}
+
+void bs_record_free(BINSTORE_RECORD * r)
+{
+  free(r->data);
+  bs_record_init(r);
+}
+
+void bs_record_grow(BINSTORE_RECORD * r, size_t bytes)
+{
+  size_t size = r->size ? r->size : 256;
+  while(r->used + bytes > size)
+    size *= 2;
+  r->data = (char *)realloc(r->data, size);
+  r->size = size;
+}
+
+void bs_end_record(BINSTORE * bs, BINSTORE_RECORD * r)
+{
+  assert(r->nesting == 0);
+  *bs_reserve(r, 1) = '\n';
+  binstore_write(bs, r->data, r->used + 1);
+  r->used = 0;
+}
+
+
 /* make sure we can read <bytes> bytes from ptr */
 const void * __binstore_read(BINSTORE * bs, size_t bytes)
 {
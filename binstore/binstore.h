@@ -8,14 +8,22 @@ extern "C" {
 #endif
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
 #include <zlib.h>
 #include "binstore.h"
 
+#define BINSTORE_CHUNK 65536  /* bytes collected before they are handed to zlib */
+
 typedef struct {
   FILE * fp;
   gzFile gz;
   /* write */
   int nesting;
+  uint64_t bytes;       /* uncompressed bytes written */
+  char * chunk;
+  size_t chunk_used;
   /* read */
   const void * buffer;
   const void * ptr;
@@ -28,8 +36,83 @@ void binstore_close(BINSTORE * bs);
 void binstore_store(BINSTORE * bs, const char * types, ...);
 void binstore_store_items(BINSTORE * bs, const char * types, ...);
 void binstore_store_end(BINSTORE * bs);
+void binstore_stats(BINSTORE * bs, uint64_t * bytes, uint64_t * bytes_compressed);
 char binstore_load(BINSTORE * bs, const void ** ptr);
 
+
+/* Typed writer: a record is built in a caller-owned BINSTORE_RECORD (one per thread, say) by the inline bs_put_*()
+   functions, without format strings or varargs, and appended to the stream in one go by bs_end_record().
+   The bytes are the same as binstore_store() writes, both can be used on one stream. */
+
+typedef struct {
+  char * data;
+  size_t used, size;
+  int nesting;
+} BINSTORE_RECORD;
+
+void bs_record_init(BINSTORE_RECORD * r);
+void bs_record_free(BINSTORE_RECORD * r);
+void bs_record_grow(BINSTORE_RECORD * r, size_t bytes);
+void bs_end_record(BINSTORE * bs, BINSTORE_RECORD * r);
+
+/* room for <bytes> more bytes in <r>, the caller advances r->used */
+static inline char * bs_reserve(BINSTORE_RECORD * r, size_t bytes)
+{
+  if (r->used + bytes > r->size)
+    bs_record_grow(r, bytes);
+  return r->data + r->used;
+}
+
+static inline void bs_put_char(BINSTORE_RECORD * r, char val)
+{
+  char * p = bs_reserve(r, 2);
+  p[0] = 'c';
+  p[1] = val;
+  r->used += 2;
+}
+
+static inline void bs_put_u32(BINSTORE_RECORD * r, uint32_t val)
+{
+  char * p = bs_reserve(r, 5);
+  p[0] = 'i';
+  memcpy(p + 1, &val, 4);
+  r->used += 5;
+}
+
+static inline void bs_put_u64(BINSTORE_RECORD * r, uint64_t val)
+{
+  char * p = bs_reserve(r, 9);
+  p[0] = 'l';
+  memcpy(p + 1, &val, 8);
+  r->used += 9;
+}
+
+static inline void bs_put_str(BINSTORE_RECORD * r, const char * val)
+{
+  uint32_t size = strlen(val) + 1;  /* with the trailing '\0', like binstore_store() */
+  char * p = bs_reserve(r, 5 + size);
+  assert(!strchr(val, '\n'));
+  p[0] = 's';
+  memcpy(p + 1, &size, 4);
+  memcpy(p + 5, val, size);
+  r->used += 5 + size;
+}
+
+static inline void bs_put_open(BINSTORE_RECORD * r)
+{
+  *bs_reserve(r, 1) = '(';
+  ++r->used;
+  ++r->nesting;
+}
+
+static inline void bs_put_close(BINSTORE_RECORD * r)
+{
+  *bs_reserve(r, 1) = ')';
+  ++r->used;
+  --r->nesting;
+  assert(r->nesting >= 0);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <structmember.h>
 #include "binstore.h"
+#include "rangemap.h"
+#include "csr.h"
 
 
 /**************************************************************************
@@ -40,12 +42,26 @@ binstore_init(binstoreObject *self, PyObject *args, PyObject *kwds)
 
 int pybinstore_store_item(binstoreObject* self, PyObject *item)
 {
+        /* integers that don't fit in 32 bits (e.g. instruction counts) are stored as 64-bit 'l' items */
         if (PyInt_Check(item)) {
-                binstore_store_items(self->bs, "i", PyInt_AS_LONG(item));
+                long val = PyInt_AS_LONG(item);
+                if (val >= 0 && (unsigned long)val <= 0xffffffffUL)
+                        binstore_store_items(self->bs, "i", (uint32_t)val);
+                else
+                        binstore_store_items(self->bs, "l", (uint64_t)val);
 
         } else if (PyLong_Check(item)) {
-                binstore_store_items(self->bs, "i", PyLong_AsLongLong(item));
-                if (PyErr_Occurred()) return 0;
+                long long val = PyLong_AsLongLong(item);
+                if (PyErr_Occurred()) {
+                        /* 2^63 and up */
+                        PyErr_Clear();
+                        val = (long long)PyLong_AsUnsignedLongLong(item);
+                        if (PyErr_Occurred()) return 0;
+                        binstore_store_items(self->bs, "l", (uint64_t)val);
+                } else if (val >= 0 && val <= 0xffffffffLL)
+                        binstore_store_items(self->bs, "i", (uint32_t)val);
+                else
+                        binstore_store_items(self->bs, "l", (uint64_t)val);
 
         } else if (PyString_Check(item)) {
                 size_t size = PyString_GET_SIZE(item);
@@ -245,11 +261,369 @@ static PyTypeObject binloadType = {
 };
 
 
+/**************************************************************************
+ ***** rangemap                                                       *****
+ **************************************************************************/
+
+typedef struct {
+        PyObject_HEAD
+        RANGEMAP rm;
+} rangemapObject;
+
+
+/* rangemap callbacks: collect ranges as (min, max, value) tuples in the list <ctx> */
+static void
+pyrangemap_found(void * ctx, uint64_t min, uint64_t max, void * value)
+{
+        PyObject * item = Py_BuildValue("(KKO)", (unsigned PY_LONG_LONG)min, (unsigned PY_LONG_LONG)max, (PyObject *)value);
+        if (item) {
+                PyList_Append((PyObject *)ctx, item);
+                Py_DECREF(item);
+        }
+}
+
+static void
+pyrangemap_removed(void * ctx, uint64_t min, uint64_t max, void * value)
+{
+        if (ctx)
+                pyrangemap_found(ctx, min, max, value);
+        Py_DECREF((PyObject *)value);
+}
+
+
+static int
+pyrangemap_init(rangemapObject *self, PyObject *args, PyObject *kwds)
+{
+        static char *kwlist[] = {NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "", kwlist))
+                return -1;
+        rangemap_clear(&self->rm, pyrangemap_removed, NULL);
+        rangemap_init(&self->rm);
+        return 0;
+}
+
+
+static PyObject *
+pyrangemap_insert(rangemapObject* self, PyObject *args)
+{
+        unsigned PY_LONG_LONG min, max;
+        PyObject * value, * removed;
+        if (!PyArg_ParseTuple(args, "KKO", &min, &max, &value))
+                return NULL;
+        if (max <= min) {
+                PyErr_SetString(PyExc_ValueError, "Empty range");
+                return NULL;
+        }
+        if (!(removed = PyList_New(0)))
+                return NULL;
+        Py_INCREF(value);
+        rangemap_insert(&self->rm, min, max, value, pyrangemap_removed, removed);
+        return removed;
+}
+
+
+static PyObject *
+pyrangemap_find(rangemapObject* self, PyObject *args)
+{
+        unsigned PY_LONG_LONG address;
+        RANGEMAP_NODE * node;
+        if (!PyArg_ParseTuple(args, "K", &address))
+                return NULL;
+        if (!(node = rangemap_find(&self->rm, address)))
+                Py_RETURN_NONE;
+        return Py_BuildValue("(KKO)", (unsigned PY_LONG_LONG)node->min, (unsigned PY_LONG_LONG)node->max, (PyObject *)node->value);
+}
+
+
+static PyObject *
+pyrangemap_get(rangemapObject* self, PyObject *args)
+{
+        unsigned PY_LONG_LONG address;
+        PyObject * def = Py_None;
+        RANGEMAP_NODE * node;
+        if (!PyArg_ParseTuple(args, "K|O", &address, &def))
+                return NULL;
+        node = rangemap_find(&self->rm, address);
+        Py_INCREF(node ? (PyObject *)node->value : def);
+        return node ? (PyObject *)node->value : def;
+}
+
+
+static PyObject *
+pyrangemap_query(rangemapObject* self, PyObject *args)
+{
+        unsigned PY_LONG_LONG min, max;
+        PyObject * found;
+        if (!PyArg_ParseTuple(args, "KK", &min, &max))
+                return NULL;
+        if (!(found = PyList_New(0)))
+                return NULL;
+        rangemap_query(&self->rm, min, max, pyrangemap_found, found);
+        return found;
+}
+
+
+static PyObject *
+pyrangemap_remove(rangemapObject* self, PyObject *args)
+{
+        unsigned PY_LONG_LONG min;
+        void * value;
+        if (!PyArg_ParseTuple(args, "K", &min))
+                return NULL;
+        if (!rangemap_remove(&self->rm, min, &value)) {
+                PyErr_SetObject(PyExc_KeyError, PyTuple_GET_ITEM(args, 0));
+                return NULL;
+        }
+        return (PyObject *)value;       /* pass on the reference held by the map */
+}
+
+
+static PyObject *
+pyrangemap_remove_range(rangemapObject* self, PyObject *args)
+{
+        unsigned PY_LONG_LONG min, max;
+        PyObject * removed;
+        if (!PyArg_ParseTuple(args, "KK", &min, &max))
+                return NULL;
+        if (!(removed = PyList_New(0)))
+                return NULL;
+        rangemap_remove_range(&self->rm, min, max, pyrangemap_removed, removed);
+        return removed;
+}
+
+
+static PyObject *
+pyrangemap_items(rangemapObject* self)
+{
+        PyObject * found;
+        if (!(found = PyList_New(0)))
+                return NULL;
+        rangemap_foreach(&self->rm, pyrangemap_found, found);
+        return found;
+}
+
+
+static Py_ssize_t
+pyrangemap_length(rangemapObject* self)
+{
+        return self->rm.size;
+}
+
+
+static unsigned PY_LONG_LONG
+pyrangemap_address(PyObject *key)
+{
+        if (PyInt_Check(key))
+                return PyInt_AsUnsignedLongLongMask(key);
+        return PyLong_AsUnsignedLongLongMask(key);
+}
+
+
+static int
+pyrangemap_contains(rangemapObject* self, PyObject *key)
+{
+        unsigned PY_LONG_LONG address = pyrangemap_address(key);
+        if (PyErr_Occurred())
+                return -1;
+        return rangemap_find(&self->rm, address) != NULL;
+}
+
+
+static PyObject *
+pyrangemap_subscript(rangemapObject* self, PyObject *key)
+{
+        unsigned PY_LONG_LONG address = pyrangemap_address(key);
+        RANGEMAP_NODE * node;
+        if (PyErr_Occurred())
+                return NULL;
+        if (!(node = rangemap_find(&self->rm, address))) {
+                PyErr_SetObject(PyExc_KeyError, key);
+                return NULL;
+        }
+        Py_INCREF((PyObject *)node->value);
+        return (PyObject *)node->value;
+}
+
+
+static void
+pyrangemap_dealloc(rangemapObject* self)
+{
+        rangemap_clear(&self->rm, pyrangemap_removed, NULL);
+        self->ob_type->tp_free(self);
+}
+
+
+static PyMethodDef rangemap_methods[] = {
+        { "insert", (PyCFunction)pyrangemap_insert, METH_VARARGS, "insert(min, max, value): add range [min, max), returns the (min, max, value) ranges it replaced" },
+        { "find", (PyCFunction)pyrangemap_find, METH_VARARGS, "find(address): (min, max, value) of the range containing address, or None" },
+        { "get", (PyCFunction)pyrangemap_get, METH_VARARGS, "get(address[, default]): value of the range containing address" },
+        { "query", (PyCFunction)pyrangemap_query, METH_VARARGS, "query(min, max): list of (min, max, value) ranges overlapping [min, max)" },
+        { "remove", (PyCFunction)pyrangemap_remove, METH_VARARGS, "remove(min): remove the range starting at min, returns its value" },
+        { "remove_range", (PyCFunction)pyrangemap_remove_range, METH_VARARGS, "remove_range(min, max): remove all ranges overlapping [min, max), returns them" },
+        { "items", (PyCFunction)pyrangemap_items, METH_NOARGS, "list of all (min, max, value) ranges" },
+        {NULL}  /* Sentinel */
+};
+
+
+static PySequenceMethods rangemap_as_sequence = {
+        sq_length:              (lenfunc)pyrangemap_length,
+        sq_contains:            (objobjproc)pyrangemap_contains,
+};
+
+
+static PyMappingMethods rangemap_as_mapping = {
+        mp_length:              (lenfunc)pyrangemap_length,
+        mp_subscript:           (binaryfunc)pyrangemap_subscript,
+};
+
+
+static PyTypeObject rangemapType = {
+        PyObject_HEAD_INIT(NULL)
+        tp_name:                "binstore.rangemap",
+        tp_basicsize:           sizeof(rangemapObject),
+        tp_flags:               Py_TPFLAGS_DEFAULT,
+        tp_doc:                 "Map of non-overlapping address ranges [min, max) to values",
+        tp_new:                 PyType_GenericNew,
+        tp_init:                (initproc)pyrangemap_init,
+        tp_dealloc:             (destructor)pyrangemap_dealloc,
+        tp_methods:             rangemap_methods,
+        tp_as_sequence:         &rangemap_as_sequence,
+        tp_as_mapping:          &rangemap_as_mapping,
+};
+
+
 /**************************************************************************
  ***** module                                                         *****
  **************************************************************************/
 
+/**************************************************************************
+ ***** csr                                                            *****
+ **************************************************************************/
+
+static PyObject *
+pycsr_store(PyObject *self, PyObject *args)
+{
+        char * filename;
+        PyObject * names;
+        const char * dst, * src, * bytes;
+        int dstlen, srclen, byteslen, compress = 0;
+        uint64_t i, nedges;
+        Py_ssize_t d, nnodes;
+        const char ** cnames;
+        CSR_EDGE * edges;
+        int result;
+
+        if (!PyArg_ParseTuple(args, "sOs#s#s#|i", &filename, &names, &dst, &dstlen, &src, &srclen, &bytes, &byteslen, &compress))
+                return NULL;
+        nedges = dstlen / sizeof(uint32_t);
+        if (dstlen != srclen || nedges * sizeof(uint32_t) != (uint64_t)dstlen || byteslen != nedges * sizeof(uint64_t)) {
+                PyErr_SetString(PyExc_ValueError, "dst and src must hold 32-bit, bytes 64-bit integers, all of the same length");
+                return NULL;
+        }
+        if (!(names = PySequence_Fast(names, "names must be a sequence")))
+                return NULL;
+        nnodes = PySequence_Fast_GET_SIZE(names);
+        cnames = malloc((nnodes + 1) * sizeof(char *));
+        for(d = 0; d < nnodes; ++d)
+                if (!(cnames[d] = PyString_AsString(PySequence_Fast_GET_ITEM(names, d)))) {
+                        free(cnames);
+                        Py_DECREF(names);
+                        return NULL;
+                }
+
+        edges = malloc((nedges + 1) * sizeof(CSR_EDGE));
+        for(i = 0; i < nedges; ++i) {
+                edges[i].dst = ((const uint32_t *)dst)[i];
+                edges[i].src = ((const uint32_t *)src)[i];
+                edges[i].bytes = ((const uint64_t *)bytes)[i];
+                if (edges[i].dst >= nnodes || edges[i].src >= nnodes) {
+                        free(edges);
+                        free(cnames);
+                        Py_DECREF(names);
+                        PyErr_SetString(PyExc_ValueError, "node index out of range");
+                        return NULL;
+                }
+        }
+        result = csr_write(filename, compress, nnodes, cnames, nedges, edges);
+        free(edges);
+        free(cnames);
+        Py_DECREF(names);
+        if (result) {
+                PyErr_SetString(PyExc_IOError, "Can't write file!");
+                return NULL;
+        }
+        Py_RETURN_NONE;
+}
+
+
+/* read <size> bytes of <gz> into a new string object */
+static PyObject *
+pycsr_section(gzFile gz, uint64_t size)
+{
+        PyObject * s = PyString_FromStringAndSize(NULL, size);
+        char * p;
+        if (!s)
+                return NULL;
+        /* gzread() takes an unsigned int */
+        for(p = PyString_AS_STRING(s); size; ) {
+                unsigned chunk = size > (1 << 30) ? (1 << 30) : (unsigned)size;
+                if (gzread(gz, p, chunk) != (int)chunk) {
+                        Py_DECREF(s);
+                        PyErr_SetString(PyExc_IOError, "Truncated CSR file");
+                        return NULL;
+                }
+                p += chunk;
+                size -= chunk;
+        }
+        return s;
+}
+
+static PyObject *
+pycsr_load(PyObject *self, PyObject *args)
+{
+        char * filename;
+        CSR_HEADER hdr;
+        gzFile gz;
+        PyObject * namebuf, * names, * rowptr = NULL, * src = NULL, * bytes = NULL, * result = NULL;
+        const char * p;
+        uint32_t d;
+
+        if (!PyArg_ParseTuple(args, "s", &filename))
+                return NULL;
+        if (!(gz = csr_open(filename, &hdr))) {
+                PyErr_SetString(PyExc_IOError, "Can't open file, or not a CSR file!");
+                return NULL;
+        }
+        if (!(namebuf = pycsr_section(gz, hdr.namebytes))) {
+                gzclose(gz);
+                return NULL;
+        }
+        names = PyList_New(hdr.nnodes);
+        for(d = 0, p = PyString_AS_STRING(namebuf); d < hdr.nnodes; ++d) {
+                PyList_SET_ITEM(names, d, PyString_FromString(p));
+                p += strlen(p) + 1;
+        }
+        Py_DECREF(namebuf);
+        if ((rowptr = pycsr_section(gz, (hdr.nnodes + 1) * sizeof(uint64_t)))
+            && (src = pycsr_section(gz, hdr.nedges * sizeof(uint32_t)))
+            && (bytes = pycsr_section(gz, hdr.nedges * sizeof(uint64_t))))
+                result = Py_BuildValue("(OOOO)", names, rowptr, src, bytes);
+        gzclose(gz);
+        Py_DECREF(names);
+        Py_XDECREF(rowptr);
+        Py_XDECREF(src);
+        Py_XDECREF(bytes);
+        return result;
+}
+
+
 static PyMethodDef BinstoreMethods[] = {
+        { "csrstore", pycsr_store, METH_VARARGS,
+          "csrstore(filename, names, dst, src, bytes[, compress]): write a communication matrix in CSR form, dst and src are "
+          "buffers (e.g. array('I')) of 32-bit indices into names, bytes one of 64-bit counts; duplicate edges are summed" },
+        { "csrload", pycsr_load, METH_VARARGS,
+          "csrload(filename): (names, rowptr, src, bytes) of a CSR file, the last three are strings holding arrays of "
+          "64-bit, 32-bit and 64-bit integers (e.g. numpy.frombuffer(rowptr, numpy.uint64))" },
         { NULL, NULL, 0, NULL }
 };
 
@@ -263,6 +637,8 @@ init_binstore(void)
                 return;
         if (PyType_Ready(&binloadType) < 0)
                 return;
+        if (PyType_Ready(&rangemapType) < 0)
+                return;
 
         m = Py_InitModule("_binstore", BinstoreMethods);
         if (m == NULL)
@@ -272,4 +648,6 @@ init_binstore(void)
         PyModule_AddObject(m, "binstore", (PyObject *)&binstoreType);
         Py_INCREF(&binloadType);
         PyModule_AddObject(m, "binload", (PyObject *)&binloadType);
+        Py_INCREF(&rangemapType);
+        PyModule_AddObject(m, "rangemap", (PyObject *)&rangemapType);
 }
@@ -0,0 +1,115 @@
+/* $Id$ */
+
+#define _LARGEFILE_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "csr.h"
+
+#define CSR_CHUNK 4096
+
+typedef struct {
+  FILE * fp;
+  gzFile gz;
+  int error;
+} CSR_OUT;
+
+static void csr_put(CSR_OUT * out, const void * data, size_t size)
+{
+  if (!size || out->error)
+    return;
+  if (out->gz)
+    out->error = gzwrite(out->gz, data, size) != (int)size;
+  else
+    out->error = fwrite(data, 1, size, out->fp) != size;
+}
+
+static int csr_compare(const void * a, const void * b)
+{
+  const CSR_EDGE * x = (const CSR_EDGE *)a, * y = (const CSR_EDGE *)b;
+  if (x->dst != y->dst)
+    return x->dst < y->dst ? -1 : 1;
+  if (x->src != y->src)
+    return x->src < y->src ? -1 : 1;
+  return 0;
+}
+
+int csr_write(const char * filename, int compress, uint32_t nnodes, const char * const * names, uint64_t nedges, CSR_EDGE * edges)
+{
+  CSR_HEADER hdr;
+  CSR_OUT out;
+  uint64_t i, n, * rowptr;
+  uint32_t d;
+
+  /* sort by (dst, src) and sum duplicates */
+  qsort(edges, nedges, sizeof(CSR_EDGE), csr_compare);
+  for(i = 0, n = 0; i < nedges; ++i)
+    if (n && !csr_compare(&edges[n - 1], &edges[i]))
+      edges[n - 1].bytes += edges[i].bytes;
+    else
+      edges[n++] = edges[i];
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CSR_MAGIC;
+  hdr.version = CSR_VERSION;
+  hdr.nnodes = nnodes;
+  hdr.nedges = n;
+  for(d = 0; d < nnodes; ++d)
+    hdr.namebytes += strlen(names[d]) + 1;
+
+  rowptr = (uint64_t *)malloc((nnodes + 1) * sizeof(uint64_t));
+  for(d = 0, i = 0; d <= nnodes; ++d) {
+    while(i < n && edges[i].dst < d)
+      ++i;
+    rowptr[d] = i;
+  }
+
+  out.fp = NULL;
+  out.gz = NULL;
+  if (compress)
+    out.gz = gzopen(filename, "wb6");
+  else
+    out.fp = fopen(filename, "wb");
+  if (!out.fp && !out.gz) {
+    free(rowptr);
+    return -1;
+  }
+  out.error = 0;
+  csr_put(&out, &hdr, sizeof(hdr));
+  for(d = 0; d < nnodes; ++d)
+    csr_put(&out, names[d], strlen(names[d]) + 1);
+  csr_put(&out, rowptr, (nnodes + 1) * sizeof(uint64_t));
+  /* the edges are stored as two arrays, written in chunks */
+  for(i = 0; i < n; i += CSR_CHUNK) {
+    uint32_t src[CSR_CHUNK];
+    uint64_t j;
+    for(j = 0; j < CSR_CHUNK && i + j < n; ++j)
+      src[j] = edges[i + j].src;
+    csr_put(&out, src, j * sizeof(uint32_t));
+  }
+  for(i = 0; i < n; i += CSR_CHUNK) {
+    uint64_t bytes[CSR_CHUNK];
+    uint64_t j;
+    for(j = 0; j < CSR_CHUNK && i + j < n; ++j)
+      bytes[j] = edges[i + j].bytes;
+    csr_put(&out, bytes, j * sizeof(uint64_t));
+  }
+  if (out.gz ? gzclose(out.gz) != Z_OK : fclose(out.fp) != 0)
+    out.error = 1;
+  free(rowptr);
+  return out.error ? -1 : 0;
+}
+
+gzFile csr_open(const char * filename, CSR_HEADER * hdr)
+{
+  gzFile gz = gzopen(filename, "rb");
+  if (!gz)
+    return NULL;
+  if (gzread(gz, hdr, sizeof(CSR_HEADER)) != sizeof(CSR_HEADER) || hdr->magic != CSR_MAGIC || hdr->version != CSR_VERSION) {
+    gzclose(gz);
+    return NULL;
+  }
+  return gz;
+}
@@ -0,0 +1,50 @@
+/* $Id$ */
+
+#ifndef CSR_H
+#define CSR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <zlib.h>
+
+/* Communication matrix in compressed sparse row form, one row per destination node:
+     CSR_HEADER
+     names      <nnodes> NUL-terminated node names, <namebytes> bytes in total
+     rowptr     <nnodes + 1> uint64_t, the edges into node d are rowptr[d] .. rowptr[d + 1] - 1
+     src        <nedges> uint32_t, source node of each edge
+     bytes      <nedges> uint64_t, bytes communicated over each edge
+   All little-endian (native x86). The whole file can be gzip-compressed, csr_open() reads both. */
+
+#define CSR_MAGIC 0x52534350  /* "PCSR" */
+#define CSR_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nnodes;
+  uint32_t pad;
+  uint64_t nedges;
+  uint64_t namebytes;
+} CSR_HEADER;
+
+typedef struct {
+  uint32_t dst, src;
+  uint64_t bytes;
+} CSR_EDGE;
+
+/* write <nedges> edges between <nnodes> nodes named <names> to <filename>, gzip-compressed if <compress>.
+   The edges are sorted in place, duplicate (dst, src) pairs are summed. Returns 0 on success. */
+int csr_write(const char * filename, int compress, uint32_t nnodes, const char * const * names, uint64_t nedges, CSR_EDGE * edges);
+
+/* open <filename> and read its header, NULL if it can't be opened or isn't a CSR file;
+   the sections that follow can then be read with gzread() */
+gzFile csr_open(const char * filename, CSR_HEADER * hdr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CSR_H
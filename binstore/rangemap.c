@@ -0,0 +1,177 @@
+/* $Id$ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include "rangemap.h"
+
+
+void rangemap_init(RANGEMAP * rm)
+{
+  rm->root = NULL;
+  rm->size = 0;
+  rm->seed = 2463534242u;
+}
+
+
+/* xorshift, we only need the priorities to look random to the tree shape */
+static unsigned int __rangemap_random(RANGEMAP * rm)
+{
+  rm->seed ^= rm->seed << 13;
+  rm->seed ^= rm->seed >> 17;
+  rm->seed ^= rm->seed << 5;
+  return rm->seed;
+}
+
+
+/* split <node> into ranges with min < key (*left) and min >= key (*right) */
+static void __rangemap_split(RANGEMAP_NODE * node, uint64_t key, RANGEMAP_NODE ** left, RANGEMAP_NODE ** right)
+{
+  if (!node) {
+    *left = *right = NULL;
+  } else if (node->min < key) {
+    __rangemap_split(node->right, key, &node->right, right);
+    *left = node;
+  } else {
+    __rangemap_split(node->left, key, left, &node->left);
+    *right = node;
+  }
+}
+
+
+/* merge two treaps, all ranges in <left> come before those in <right> */
+static RANGEMAP_NODE * __rangemap_merge(RANGEMAP_NODE * left, RANGEMAP_NODE * right)
+{
+  if (!left)
+    return right;
+  if (!right)
+    return left;
+  if (left->priority > right->priority) {
+    left->right = __rangemap_merge(left->right, right);
+    return left;
+  } else {
+    right->left = __rangemap_merge(left, right->left);
+    return right;
+  }
+}
+
+
+/* free all nodes in <node>, in address order */
+static size_t __rangemap_free(RANGEMAP_NODE * node, rangemap_callback removed, void * ctx)
+{
+  size_t count;
+  if (!node)
+    return 0;
+  count = __rangemap_free(node->left, removed, ctx);
+  if (removed)
+    removed(ctx, node->min, node->max, node->value);
+  count += 1 + __rangemap_free(node->right, removed, ctx);
+  free(node);
+  return count;
+}
+
+
+static void __rangemap_walk(RANGEMAP_NODE * node, uint64_t min, uint64_t max, rangemap_callback found, void * ctx)
+{
+  if (!node)
+    return;
+  if (node->min > min)
+    __rangemap_walk(node->left, min, max, found, ctx);
+  if (node->min < max && node->max > min)
+    found(ctx, node->min, node->max, node->value);
+  if (node->min < max)
+    __rangemap_walk(node->right, min, max, found, ctx);
+}
+
+
+void rangemap_clear(RANGEMAP * rm, rangemap_callback removed, void * ctx)
+{
+  __rangemap_free(rm->root, removed, ctx);
+  rm->root = NULL;
+  rm->size = 0;
+}
+
+
+void rangemap_remove_range(RANGEMAP * rm, uint64_t min, uint64_t max, rangemap_callback removed, void * ctx)
+{
+  RANGEMAP_NODE * left, * middle, * right, * last;
+
+  __rangemap_split(rm->root, min, &left, &right);
+  /* the range just before <min> may extend into [min, max) */
+  for(last = left; last && last->right; last = last->right)
+    ;
+  if (last && last->max > min) {
+    RANGEMAP_NODE * before;
+    __rangemap_split(left, last->min, &before, &middle);
+    assert(middle == last && !middle->left && !middle->right);
+    left = before;
+    if (removed)
+      removed(ctx, middle->min, middle->max, middle->value);
+    free(middle);
+    --rm->size;
+  }
+  /* everything starting inside [min, max) overlaps */
+  __rangemap_split(right, max > min ? max : min + 1, &middle, &right);
+  rm->size -= __rangemap_free(middle, removed, ctx);
+  rm->root = __rangemap_merge(left, right);
+}
+
+
+void rangemap_insert(RANGEMAP * rm, uint64_t min, uint64_t max, void * value, rangemap_callback removed, void * ctx)
+{
+  RANGEMAP_NODE * node = (RANGEMAP_NODE *)malloc(sizeof(RANGEMAP_NODE)), * left, * right;
+
+  assert(max > min);
+  rangemap_remove_range(rm, min, max, removed, ctx);
+  node->min = min;
+  node->max = max;
+  node->value = value;
+  node->priority = __rangemap_random(rm);
+  node->left = node->right = NULL;
+  __rangemap_split(rm->root, min, &left, &right);
+  rm->root = __rangemap_merge(__rangemap_merge(left, node), right);
+  ++rm->size;
+}
+
+
+/* range containing <address>, NULL if there is none */
+RANGEMAP_NODE * rangemap_find(RANGEMAP * rm, uint64_t address)
+{
+  RANGEMAP_NODE * node = rm->root, * best = NULL;
+  while(node) {
+    if (node->min <= address) {
+      best = node;
+      node = node->right;
+    } else
+      node = node->left;
+  }
+  return best && best->max > address ? best : NULL;
+}
+
+
+void rangemap_query(RANGEMAP * rm, uint64_t min, uint64_t max, rangemap_callback found, void * ctx)
+{
+  __rangemap_walk(rm->root, min, max > min ? max : min + 1, found, ctx);
+}
+
+
+void rangemap_foreach(RANGEMAP * rm, rangemap_callback found, void * ctx)
+{
+  __rangemap_walk(rm->root, 0, UINT64_MAX, found, ctx);
+}
+
+
+/* remove the range starting at <min>, returns 0 if there is none */
+int rangemap_remove(RANGEMAP * rm, uint64_t min, void ** value)
+{
+  RANGEMAP_NODE ** link = &rm->root, * node;
+  while(*link && (*link)->min != min)
+    link = min < (*link)->min ? &(*link)->left : &(*link)->right;
+  if (!(node = *link))
+    return 0;
+  *link = __rangemap_merge(node->left, node->right);
+  if (value)
+    *value = node->value;
+  free(node);
+  --rm->size;
+  return 1;
+}
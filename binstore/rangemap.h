@@ -0,0 +1,46 @@
+/* $Id$ */
+
+#ifndef RANGEMAP_H
+#define RANGEMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Map of non-overlapping address ranges [min, max) to values, kept in a treap ordered by min.
+   Inserting a range removes all ranges it overlaps with, so lookups of a single address
+   only need to look at the range with the largest min <= address. */
+
+typedef struct rangemap_node {
+  uint64_t min, max;
+  void * value;
+  unsigned int priority;
+  struct rangemap_node * left, * right;
+} RANGEMAP_NODE;
+
+typedef struct {
+  RANGEMAP_NODE * root;
+  size_t size;
+  unsigned int seed;
+} RANGEMAP;
+
+/* called for every range removed or found, in address order */
+typedef void (*rangemap_callback)(void * ctx, uint64_t min, uint64_t max, void * value);
+
+void rangemap_init(RANGEMAP * rm);
+void rangemap_clear(RANGEMAP * rm, rangemap_callback removed, void * ctx);
+void rangemap_insert(RANGEMAP * rm, uint64_t min, uint64_t max, void * value, rangemap_callback removed, void * ctx);
+RANGEMAP_NODE * rangemap_find(RANGEMAP * rm, uint64_t address);
+void rangemap_query(RANGEMAP * rm, uint64_t min, uint64_t max, rangemap_callback found, void * ctx);
+int rangemap_remove(RANGEMAP * rm, uint64_t min, void ** value);
+void rangemap_remove_range(RANGEMAP * rm, uint64_t min, uint64_t max, rangemap_callback removed, void * ctx);
+void rangemap_foreach(RANGEMAP * rm, rangemap_callback found, void * ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RANGEMAP_H
@@ -75,7 +75,7 @@ class RangeDictO:
     if not self.data and not self.parts: return False
     if not key.overlaps(self.range): return False
     if key in self.data: return True
-    for __key in xrange(int(item.min / self.size), int(item.max / self.size) + 1):
+    for __key in xrange(int(key.min / self.size), int(key.max / self.size) + 1):
       if __key in self.parts:
         if key in self.parts[__key]:
           return True
@@ -0,0 +1,88 @@
+/* $Id$ */
+
+/* Lock-free shadow memory: a four-level radix table from a 48-bit key (a granule number) to a 32-bit value,
+   used by pincomm -regiononly for the region that last wrote each granule. Tables are allocated on the first
+   write below them and installed with compare-and-swap, so lookups and updates never take a lock. A value is
+   a single aligned word, concurrent accesses to the same granule race the way the application's do.
+   The pagetable_*64() functions keep 64-bit values instead (pincomm -cache, per line), a table must only be
+   used with one of both. */
+
+#ifndef PAGETABLE_H
+#define PAGETABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define PAGETABLE_BITS 12
+#define PAGETABLE_SIZE (1 << PAGETABLE_BITS)
+#define PAGETABLE_LEVELS 4
+
+typedef struct {
+  void * volatile top[PAGETABLE_SIZE];
+  volatile uint64_t leaves;     /* leaf tables allocated, PAGETABLE_SIZE values each */
+} PAGETABLE;
+
+/* the table below <slot>, allocating it if <create> */
+static inline void * pagetable_child(PAGETABLE * pt, void * volatile * slot, size_t size, int leaf, int create)
+{
+  void * p = *slot, * n;
+  if (p || !create)
+    return p;
+  n = calloc(1, size);
+  if (__sync_bool_compare_and_swap(slot, (void *)0, n)) {
+    if (leaf)
+      __sync_fetch_and_add(&pt->leaves, 1);
+    return n;
+  }
+  free(n);      /* another thread was first */
+  return *slot;
+}
+
+/* the leaf table of <key>, with values of <valuesize> bytes, NULL if nothing below it was ever written and !<create> */
+static inline void * pagetable_leaf(PAGETABLE * pt, uint64_t key, size_t valuesize, int create)
+{
+  void * volatile * table = pt->top;
+  int level;
+  for(level = PAGETABLE_LEVELS - 1; level > 0; --level) {
+    void * volatile * slot = &table[(key >> (level * PAGETABLE_BITS)) & (PAGETABLE_SIZE - 1)];
+    table = (void * volatile *)pagetable_child(pt, slot,
+      PAGETABLE_SIZE * (level == 1 ? valuesize : sizeof(void *)), level == 1, create);
+    if (!table)
+      return NULL;
+  }
+  return (void *)table;
+}
+
+/* where the value of <key> is kept, NULL if nothing below it was ever written and !<create> */
+static inline volatile uint32_t * pagetable_slot(PAGETABLE * pt, uint64_t key, int create)
+{
+  volatile uint32_t * leaf = (volatile uint32_t *)pagetable_leaf(pt, key, sizeof(uint32_t), create);
+  return leaf ? &leaf[key & (PAGETABLE_SIZE - 1)] : NULL;
+}
+
+static inline volatile uint64_t * pagetable_slot64(PAGETABLE * pt, uint64_t key, int create)
+{
+  volatile uint64_t * leaf = (volatile uint64_t *)pagetable_leaf(pt, key, sizeof(uint64_t), create);
+  return leaf ? &leaf[key & (PAGETABLE_SIZE - 1)] : NULL;
+}
+
+static inline uint32_t pagetable_get(PAGETABLE * pt, uint64_t key)
+{
+  volatile uint32_t * v = pagetable_slot(pt, key, 0);
+  return v ? *v : 0;
+}
+
+static inline void pagetable_set(PAGETABLE * pt, uint64_t key, uint32_t value)
+{
+  *pagetable_slot(pt, key, 1) = value;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PAGETABLE_H
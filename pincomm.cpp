@@ -4,12 +4,22 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <map>
+#include <set>
+#include <vector>
 #include <deque>
+#include <algorithm>
 #include <assert.h>
 #include "pin.H"
 #include "pinmagic.h"
 #include "binstore.h"
+#include "csr.h"
+#define SHMRING_YIELD() PIN_Yield()
+#include "shmring.h"
+#include "pagetable.h"
 
 
 
@@ -22,8 +32,13 @@ F   function name
 G   region change
 I   instruction count
 J   jump (stack mismatch)
+K   cache misses and invalidations per source region (-cache)
+U   first-touching thread and bytes read and written per region of a page (-numa)
+B   acquires, handoffs and bytes of a lock, condition variable, barrier or futex (-sync)
 M   malloc
 N   free
+O   communication per object
+P   pintool statistics (-stats)
 R   read
 S   stack contents
 T   set region
@@ -38,12 +53,22 @@ END   end
 
 
 BINSTORE * trace;
+SHMRING * shmring = NULL;   /* -shmring */
 
 
 
 #define MAX_THREADS 1024
 #define MAX_STACK 1024
 #define MAX_MREGION (1<<22)
+#define ICOUNT_FLUSH 4096
+#define COMBINE_ROLLUP 65536   /* minimum number of collapsed (-minlen) regions kept before they are rolled up */
+#define LATENCY_BUCKETS 48
+#define LATENCY_FLUSH 256
+#define FALSESHARE_LINE_BITS 6
+#define FALSESHARE_WRITERS 4
+#define FALSESHARE_OWNERS 4
+#define FALSESHARE_THREADS 64
+#define REGIONONLY_DENSE 64
 
 
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
@@ -54,6 +79,12 @@ KNOB<BOOL> KnobUseMagic(KNOB_MODE_WRITEONCE, "pintool",
     "magic", "0", "use Simics Magic instruction to start/stop measurement");
 KNOB<INT> KnobZone(KNOB_MODE_WRITEONCE, "pintool",
     "zone", "0", "only measure zone <zone>");
+KNOB<UINT64> KnobSkip(KNOB_MODE_WRITEONCE, "pintool",
+    "skip", "0", "fast-forward <skip> instructions (total over all threads), counting only instructions, before measuring");
+KNOB<UINT64> KnobLength(KNOB_MODE_WRITEONCE, "pintool",
+    "length", "0", "measure <length> instructions after -skip, then detach (0: until the end)");
+KNOB<string> KnobWindows(KNOB_MODE_WRITEONCE, "pintool",
+    "windows", "", "measure only the windows <start>:<length>[,<start>:<length>]* (instruction counts over all threads), each in its own START/STOP section, and fast-forward in between");
 KNOB<BOOL> KnobIgnoreComm(KNOB_MODE_WRITEONCE, "pintool",
     "nocomm", "0", "don't measure communication (only call tree and malloc()s)");
 KNOB<UINT> KnobMinLen(KNOB_MODE_WRITEONCE, "pintool",
@@ -66,17 +97,107 @@ KNOB<BOOL> KnobRegionOnly(KNOB_MODE_WRITEONCE, "pintool",
     "regiononly", "0", "only measure inter-region communication, output in csv format to stdout");
 KNOB<string> KnobCsvOutputFile(KNOB_MODE_WRITEONCE, "pintool",
     "csv", "pincommtrace.csv", "output file name for CSV output");
+KNOB<string> KnobCsrOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+    "csrout", "", "write the -regiononly matrix in binary CSR form to <csrout> instead of CSV, gzip-compressed if it ends in .gz");
+KNOB<BOOL> KnobObjects(KNOB_MODE_WRITEONCE, "pintool",
+    "objects", "0", "attribute communication to the objects (malloc()s, PIN_TRACK) it went through");
+KNOB<UINT64> KnobStats(KNOB_MODE_WRITEONCE, "pintool",
+    "stats", "0", "write pintool statistics every <stats> instructions, and a summary to stderr at the end");
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool",
+    "interval", "0", "write the (thread, region) communication matrix of the last <interval> instructions as a 'V' record");
+KNOB<UINT> KnobIntervalMax(KNOB_MODE_WRITEONCE, "pintool",
+    "intervalmax", "65536", "maximum number of -interval matrix entries kept in memory, write a partial 'V' record when exceeded");
+KNOB<BOOL> KnobLatency(KNOB_MODE_WRITEONCE, "pintool",
+    "latency", "0", "keep log2 histograms of the number of instructions between write and read, written as 'H' records");
+KNOB<UINT> KnobCache(KNOB_MODE_WRITEONCE, "pintool",
+    "cache", "0", "model a private LRU cache of <cache> KiB per thread, invalidated by other threads' writes, and write its misses and invalidations per region pair as 'K' records");
+KNOB<UINT> KnobCacheAssoc(KNOB_MODE_WRITEONCE, "pintool",
+    "cacheassoc", "8", "associativity of the -cache caches");
+KNOB<UINT> KnobCacheLine(KNOB_MODE_WRITEONCE, "pintool",
+    "cacheline", "64", "line size of the -cache caches (bytes)");
+KNOB<UINT> KnobNuma(KNOB_MODE_WRITEONCE, "pintool",
+    "numa", "0", "per page of <numa> bytes (4096 or 2097152), record the first-touching thread and the bytes each region read and wrote, and write them as 'U' records");
+KNOB<BOOL> KnobSync(KNOB_MODE_WRITEONCE, "pintool",
+    "sync", "0", "intercept pthread locks, condition variables, barriers and futexes, keep their own traffic out of the matrix, and write handoffs and the communication each one ordered as 'B' records");
+KNOB<BOOL> KnobFalseShare(KNOB_MODE_WRITEONCE, "pintool",
+    "falseshare", "0", "classify cache line transfers between threads as true or false sharing, write the worst lines as 'L' records");
+KNOB<UINT> KnobFalseShareTop(KNOB_MODE_WRITEONCE, "pintool",
+    "falsesharetop", "100", "number of lines with most false sharing to write with -falseshare");
+KNOB<BOOL> KnobHotLoads(KNOB_MODE_WRITEONCE, "pintool",
+    "hotloads", "0", "count communicated bytes per load instruction, write the top ones as 'D' records");
+KNOB<UINT> KnobHotLoadsTop(KNOB_MODE_WRITEONCE, "pintool",
+    "hotloadstop", "100", "number of load instructions to write with -hotloads");
+KNOB<string> KnobSymCache(KNOB_MODE_WRITEONCE, "pintool",
+    "symcache", "", "directory to cache per-image function and call site tables in, the trace then refers to them with 'Y' records");
+KNOB<string> KnobShmRing(KNOB_MODE_WRITEONCE, "pintool",
+    "shmring", "", "push memory accesses into the shared memory rings created by pincommring at <shmring>, which does the -regiononly analysis");
+
+
+/* -stats: per-thread counts of analysis calls by type, and of cycles spent waiting for the client lock */
+enum { STAT_BBL, STAT_READ, STAT_WRITE, STAT_ENTRY, STAT_RETURN, STAT_ALLOC, STAT_MAGIC, STAT_LOCK, STAT_NUM };
+static const char * statNames[STAT_NUM] = { "bbl", "read", "write", "entry", "return", "alloc", "magic", "lock" };
+struct threadStatsType {
+  UINT64 calls[STAT_NUM];
+  UINT64 lockwait;
+  UINT8 pad[128 - (STAT_NUM + 1) * sizeof(UINT64)];
+};
+static threadStatsType tstats[MAX_THREADS];
+static BOOL dostats = FALSE;
+static UINT64 stats_next = 0;
+
+#define STAT(threadid, type) do { if (dostats && (threadid) < MAX_THREADS) ++tstats[threadid].calls[type]; } while(0)
+
+inline UINT64 rdtsc() {
+  UINT32 lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return (UINT64)hi << 32 | lo;
+}
+
+
+/* trace records are built with binstore's typed writer, under the client lock: trec[] for records about one thread
+   (E, X, M, N, G), rec for all others */
+static BINSTORE_RECORD rec, trec[MAX_THREADS];
 
 
 /* lock to put around writing output, so lines from separate threads don't intermingle */
-inline void L() { PIN_LockClient(); }
+inline void L() {
+  if (dostats) {
+    THREADID threadid = PIN_ThreadId();
+    UINT64 start = rdtsc();
+    PIN_LockClient();
+    if (threadid < MAX_THREADS) {
+      tstats[threadid].lockwait += rdtsc() - start;
+      ++tstats[threadid].calls[STAT_LOCK];
+    }
+  } else
+    PIN_LockClient();
+}
 inline void U() { PIN_UnlockClient(); }
 
 
 static enum { S_INIT, S_MEASURE, S_DONE } state;
 
-static UINT64 icount[MAX_THREADS] = { 0 };
-static UINT64 icount_tot = 0, icount_next = 0;
+/* per-thread instruction counts, padded to a cache line so threads don't false-share them.
+   icount_tot is only updated once a thread has <icount_flush> unflushed instructions,
+   the -regiontime slice (epoch) is derived from it; each thread recomputes its own region
+   once it notices the epoch has changed. <region> is a copy of region[threadid] that can be read without the client lock */
+struct threadCountType {
+  UINT64 icount;
+  UINT64 icount_flushed;
+  UINT64 epoch;
+  UINT64 region;
+  UINT8 pad[64 - 4 * sizeof(UINT64)];
+};
+static threadCountType tcount[MAX_THREADS];
+static UINT64 icount_tot = 0, icount_flush = ICOUNT_FLUSH;
+/* -skip, -length, -windows: [start, end) instruction counts to measure, the next one is windows[window].
+   icount_run counts flushed instructions since the program started. While fast-forwarding, only instructions
+   are counted, the rest of the instrumentation is removed and put back when the next window starts */
+static std::vector<std::pair<UINT64, UINT64> > windows;
+static size_t window = 0;
+static UINT64 icount_run = 0;
+static BOOL fastforward = FALSE;
+static volatile UINT64 epoch = 0;
 static UINT64 icount_read = 0, bcount_read = 0;
 static UINT64 icount_read_cache = 0, bcount_read_cache = 0;
 
@@ -99,19 +220,192 @@ static callStackType callStack;
 
 static std::map<THREADID, UINT32> dfuncid;
 static std::map<THREADID, UINT64> region;
-static std::map<ADDRINT, UINT64> lastwritten;
-static std::map<ADDRINT, UINT64> readby;
+/* shadow memory, one entry per <memgran> bytes */
+struct shadowType {
+  UINT64 lastwritten;   /* region that last wrote here */
+  UINT64 readby;        /* bitmask of threads that have read here since */
+  UINT32 object;        /* -objects: index in objects of the object last written here */
+};
+typedef std::map<ADDRINT, shadowType> shadowMapType;
+static shadowMapType shadow;
+/* readby has a bit for threads below READBY_THREADS, others never look like they have read a granule */
+#define READBY_THREADS 64
+inline UINT64 readbyBit(THREADID threadid) { return threadid < READBY_THREADS ? (UINT64)1 << threadid : 0; }
 typedef std::map<UINT64, UINT64> commItemType;
 typedef std::map<UINT64, commItemType> commType;
 static commType comm;
+/* -objects: communication per (source region, object) */
+typedef std::pair<UINT64, UINT32> ocommKeyType;
+typedef std::map<ocommKeyType, UINT64> ocommItemType;
+typedef std::map<UINT64, ocommItemType> ocommType;
+static ocommType ocomm;
+/* regions collapsed into their parent (-minlen) form a union-find forest: combine[child] = parent */
 static std::map<UINT64, UINT64> combine;
-static std::map<UINT64, std::map<UINT64, UINT64> > only_region;
+/* -interval: bytes communicated during the current interval, (dst, src) -> bytes with both sides a (mregion << 10 | tid) node */
+typedef std::map<std::pair<UINT32, UINT32>, UINT64> intervalType;
+static intervalType imatrix;
+static UINT64 interval_next = 0, interval_seq = 0;
+/* -latency: global instruction count of the last write per shadow entry (kept apart so the shadow memory
+   doesn't grow without -latency), and per (region, source region) the bytes read by log2 of the distance */
+struct latencyType {
+  UINT64 bytes[LATENCY_BUCKETS];
+  latencyType() { memset(bytes, 0, sizeof(bytes)); }
+};
+typedef std::map<UINT64, latencyType> latencyItemType;
+typedef std::map<UINT64, latencyItemType> latencyCommType;
+static std::map<ADDRINT, UINT64> writetime;
+static latencyCommType lcomm;
+/* -cache: a private set-associative cache per thread, <cache_assoc> tags per set in most recently used first order.
+   A tag is the line number + 1, 0 is an empty way. Writes invalidate the line in the other caches but leave
+   its tag with CACHE_INVALID set, so a later miss on it is known to be a coherence miss. Per line, the threads
+   below CACHE_THREADS that have a valid copy are kept in cache_sharers, so a write only probes their caches
+   (and those of cacheUntracked, the threads from CACHE_THREADS on) instead of every thread's */
+#define CACHE_INVALID ((UINT64)1 << 63)
+#define CACHE_THREADS 64
+enum { CACHE_COHERENCE, CACHE_CAPACITY, CACHE_COLD, CACHE_INVALIDATION, CACHE_COUNTS };
+enum { CACHE_HIT, CACHE_MISS, CACHE_INVALIDATED };
+static UINT64 * caches[MAX_THREADS];     /* allocated on first use, <cache_sets> * <cache_assoc> tags */
+static PAGETABLE cache_sharers;           /* line -> bitmask of threads holding a valid copy (pagetable_*64) */
+static std::vector<THREADID> cacheUntracked;  /* threads from CACHE_THREADS on that have a cache */
+static BOOL docache = FALSE;              /* -cache, and neither -regiononly nor -shmring */
+static UINT32 cache_sets, cache_assoc, cache_line_bits;
+/* misses of reads in (region, source region) by kind, and invalidations of lines held by region caused by writes in
+   source region */
+struct cacheCountType {
+  UINT64 count[CACHE_COUNTS];
+  cacheCountType() { memset(count, 0, sizeof(count)); }
+};
+typedef std::map<UINT64, cacheCountType> cacheItemType;
+typedef std::map<UINT64, cacheItemType> cacheCommType;
+static cacheCommType kcomm;
+/* -numa: per page, the thread that touched it first (where Linux would place it) and the allocation it is in,
+   and the bytes read and written in it by each (thread, mregion). The first touch is recorded outside
+   START/STOP too and outlives it, the counts are written and cleared by each STOP */
+struct numaAccessType {
+  UINT32 treg;          /* mregion << 10 | threadid */
+  UINT64 read, write;
+};
+struct numaPageType {
+  UINT32 first;         /* first-touching thread */
+  UINT32 object;        /* object the first touch was in */
+  std::vector<numaAccessType> access;
+};
+typedef std::map<ADDRINT, numaPageType> numaPageMapType;
+static numaPageMapType numapages;
+static BOOL donuma = FALSE;               /* -numa, and neither -regiononly nor -shmring */
+static UINT32 numa_page_bits;
+/* last page each thread looked up */
+struct numaCacheType {
+  ADDRINT page;
+  numaPageType * entry;
+};
+static numaCacheType numaCache[MAX_THREADS];
+/* -falseshare: per cache line, the threads that hold an up-to-date copy, and for its recent writers the bytes each
+   wrote since it last took the line from another thread. An access by a thread without a copy transfers the line,
+   which is true sharing if it touches any of the bytes the other writers wrote. Only threads below
+   FALSESHARE_THREADS are tracked, the accesses of others are counted in falseshare_untracked */
+struct falseShareType {
+  UINT64 copies;                        /* threads with an up-to-date copy of the line */
+  UINT64 transfers[2];                  /* transfers to another thread: [0] false sharing, [1] true sharing */
+  UINT32 owners[FALSESHARE_OWNERS];     /* writers + 1, most recent first, 0 if none */
+  UINT64 masks[FALSESHARE_OWNERS];      /* bytes written by owners[i] since it last took the line */
+  UINT64 olderby;                       /* threads that were dropped from owners[] */
+  UINT64 older;                         /* the bytes they had written */
+  UINT32 object;                        /* object last written here */
+  UINT32 writers[FALSESHARE_WRITERS];   /* static functions that last wrote here, most recent first */
+};
+typedef std::map<ADDRINT, falseShareType> falseShareMapType;
+static falseShareMapType fslines;
+static UINT64 falseshare_untracked = 0;
+/* -hotloads: communication per load instruction, one table per thread, merged when measurement stops */
+struct pcCountType {
+  UINT64 bytes;         /* communicated bytes read */
+  UINT64 loads;         /* executions that read communicated data */
+  UINT64 misses;        /* executions that read data not yet read by this thread since it was written */
+  UINT32 funcid;
+};
+typedef std::map<ADDRINT, pcCountType> pcCountMapType;
+static pcCountMapType pccount[MAX_THREADS];
+/* -regiononly: bytes read per (source mregion, destination mregion), kept per reading thread and merged at the end.
+   Pairs of region ids below REGIONONLY_DENSE go in a dense matrix, others in an open-addressing hash table */
+struct regionOnlyType {
+  UINT64 (*dense)[REGIONONLY_DENSE];  /* allocated on first use */
+  UINT64 * keys;                      /* src << 32 | dst, 0 is an empty slot (such pairs are always dense) */
+  UINT64 * values;
+  UINT64 size, used;
+};
+static regionOnlyType only_region[MAX_THREADS];
+/* -regiononly: the mregion that last wrote each granule, lock-free so accesses don't need the client lock */
+static PAGETABLE only_shadow;
 
 
 static unsigned int lognextobject[MAX_THREADS] = { 0 };
 
-/*static ADDRINT malloc_returnip[MAX_THREADS] = { 0 };
-static ADDRINT malloc_size[MAX_THREADS] = { 0 };*/
+/* -objects: objects are identified by their object id (PIN_MALLOC, PIN_TRACK) and allocation site,
+   index 0 is 'not inside any object'. objranges maps the start address of each live allocation
+   to its end address and object index */
+struct objectType {
+  UINT32 objectid;
+  ADDRINT site;
+};
+static std::vector<objectType> objects(1);
+static std::map<std::pair<UINT32, ADDRINT>, UINT32> objectIndex;
+typedef std::map<ADDRINT, std::pair<ADDRINT, UINT32> > objRangesType;
+static objRangesType objranges;
+/* last range each thread looked up, invalidated by objectInvalidate() when an allocation overlapping it changes */
+struct objCacheType {
+  BOOL valid;
+  ADDRINT start, end;
+  UINT32 object;
+};
+static objCacheType objCache[MAX_THREADS];
+static std::vector<THREADID> objCacheThreads;  /* threads that have looked up an object */
+static BOOL doobjects = FALSE;  /* track objects, for -objects, -falseshare or -numa */
+/* -symcache: images of which the 'F' and 'A' records are in a cache file, referenced by a 'Y' record */
+static std::set<UINT32> cachedImages;
+/* allocator (FALSE) and -sync (TRUE) routines by address, with their index in allocRtns or syncRtns */
+typedef std::pair<BOOL, unsigned int> hookRtnType;
+static std::map<ADDRINT, hookRtnType> hookRtns;
+static std::set<UINT32> routinesSeen;  /* routines whose 'F' and 'A' records were written */
+
+/* allocator call in progress, between AllocBefore() and AllocAfter() */
+struct allocPendingType {
+  UINT32 depth;         /* nested allocator calls (operator new -> malloc), only the outermost one is logged */
+  UINT32 kind;
+  ADDRINT sp;
+  ADDRINT size;         /* calloc: element size */
+  ADDRINT count;        /* calloc: number of elements */
+  ADDRINT address;      /* realloc: old block, posix_memalign: where the result will be stored */
+  ADDRINT returnIp;
+};
+static allocPendingType allocPending[MAX_THREADS];
+static std::set<ADDRINT> mmapped;  /* anonymous mappings we logged, other munmap()s are ignored */
+/* -sync: the pthread routine (or futex system call) each thread is in, accesses made there, and reads of futex
+   words, are synchronization traffic. Communication outside is attributed to the sync object that ordered it: the innermost lock the thread
+   holds, or else the barrier, condition variable or futex it last waited on */
+enum syncObjectKind { SO_LOCK, SO_COND, SO_BARRIER, SO_FUTEX };
+struct syncPendingType {
+  UINT32 depth;         /* nested sync routines (pthread_cond_wait -> pthread_mutex_lock), only the outermost one counts */
+  UINT32 kind;
+  ADDRINT sp;
+  ADDRINT object, arg1;
+};
+static syncPendingType syncPending[MAX_THREADS];
+static std::vector<ADDRINT> syncHeld[MAX_THREADS];  /* locks held, innermost last */
+static ADDRINT syncEpisode[MAX_THREADS];            /* barrier, condition variable or futex last waited on */
+struct syncType {
+  UINT32 kind;          /* syncObjectKind */
+  UINT32 last;          /* last thread to acquire or release it + 1 */
+  UINT64 acquires;
+  UINT64 handoffs;      /* acquires by another thread than the last one */
+  UINT64 syncbytes;     /* communicated bytes read inside sync routines working on it */
+  UINT64 databytes;     /* communicated bytes read while it was the thread's sync episode */
+};
+typedef std::map<ADDRINT, syncType> syncMapType;
+static syncMapType syncs;
+static BOOL dosync = FALSE;               /* -sync, and neither -regiononly nor -shmring */
+static std::set<ADDRINT> futexWords;      /* futex words seen in a futex system call, reads of them are sync traffic */
+static BOOL syncInFutex[MAX_THREADS];     /* in a futex system call that is not part of a pthread routine */
 
 
 int ln2(int value)
@@ -175,27 +469,34 @@ static void printStack(THREADID threadid)
 {
   if (!callStack[threadid].empty()) {
     L();
-    binstore_store_items(trace, "ci", 'S', threadid);
-    for(threadStackType::iterator it = callStack[threadid].begin(); it != callStack[threadid].end(); ++it)
-      binstore_store_items(trace, "(ii)", it->funcid, it->returnIp);
-    binstore_store_end(trace);
+    bs_put_char(&rec, 'S');
+    bs_put_u32(&rec, threadid);
+    for(threadStackType::iterator it = callStack[threadid].begin(); it != callStack[threadid].end(); ++it) {
+      bs_put_open(&rec);
+      bs_put_u32(&rec, it->funcid);
+      bs_put_u32(&rec, it->returnIp);
+      bs_put_close(&rec);
+    }
+    bs_end_record(trace, &rec);
     U();
   }
 }
 
 
 UINT64 makeRegion(THREADID threadid, stackItemType & item) {
-  UINT64 mr = KnobRegionTime.Value() ? icount_tot / KnobRegionTime.Value() : item.mregion;
+  UINT64 mr = KnobRegionTime.Value() ? tcount[threadid].epoch : item.mregion;
   assert(mr < MAX_MREGION);
   return (UINT64)item.dfuncid << 32 | mr << 10 | threadid;
 }
 
-VOID storeRegion(BINSTORE * trace, UINT64 region) {
-  binstore_store_items(trace, "iii", (UINT32)(region & 0x3ff) /* threadid */,
-    (UINT32)((region >> 10) & 0x3fffff) /* mreg */, (UINT32)(region >> 32) /* dfid */);
+inline void bs_put_region(BINSTORE_RECORD * r, UINT64 region) {
+  bs_put_u32(r, region & 0x3ff);                /* threadid */
+  bs_put_u32(r, (region >> 10) & 0x3fffff);     /* mreg */
+  bs_put_u32(r, region >> 32);                  /* dfid */
 }
 
 VOID setRegion(THREADID threadid) {
+  tcount[threadid].epoch = epoch;
   if (!callStack[threadid].empty()) {
     region[threadid] = makeRegion(threadid, callStack[threadid].back());
     /*if (state == S_MEASURE) {
@@ -205,6 +506,7 @@ VOID setRegion(THREADID threadid) {
     }*/
   } else
     region[threadid] = threadid;
+  tcount[threadid].region = region[threadid];
 }
 
 
@@ -216,54 +518,366 @@ VOID outputSelfAndParents(THREADID threadid) {
       --i;
     for(i = i + 1; i < callStack[threadid].size(); ++i) {
       stackItemType & item = callStack[threadid][i];
-      binstore_store(trace, "ciiiil", 'E', threadid, item.funcid, item.dfuncid, item.returnIp, item.icounttot_start);
+      BINSTORE_RECORD * r = &trec[threadid];
+      bs_put_char(r, 'E');
+      bs_put_u32(r, threadid);
+      bs_put_u32(r, item.funcid);
+      bs_put_u32(r, item.dfuncid);
+      bs_put_u32(r, item.returnIp);
+      bs_put_u64(r, item.icounttot_start);
+      bs_end_record(trace, r);
       item.output = 1;
     }
   }
 }
 
 
-VOID storeComm(UINT64 region) {
-  /* collapse combined regions */
-  for(std::map<UINT64, UINT64>::iterator it = comm[region].begin(); it != comm[region].end(); ++it) {
-    if (combine.count(it->first)) {
-      UINT64 parent = combine[it->first];
-      while(combine.count(parent))
-        parent = combine[parent];
-      comm[region][parent] += it->second;
-      comm[region][it->first] = 0;
+/* find the region <region> was collapsed into, compressing the path on the way */
+UINT64 findRegion(UINT64 region) {
+  std::map<UINT64, UINT64>::iterator it;
+  UINT64 root = region;
+  while((it = combine.find(root)) != combine.end())
+    root = it->second;
+  while((it = combine.find(region)) != combine.end() && it->second != root) {
+    region = it->second;
+    it->second = root;
+  }
+  return root;
+}
+
+
+/* replace collapsed regions in the communication row of <region> with the region they were collapsed into */
+VOID collapseComm(commItemType & row) {
+  if (combine.empty())
+    return;
+  for(commItemType::iterator it = row.begin(); it != row.end(); ++it) {
+    if (it->second && combine.count(it->first)) {
+      row[findRegion(it->first)] += it->second;
+      it->second = 0;
+    }
+  }
+}
+
+
+VOID collapseObjectComm(ocommItemType & row) {
+  if (combine.empty())
+    return;
+  for(ocommItemType::iterator it = row.begin(); it != row.end(); ++it) {
+    if (it->second && combine.count(it->first.first)) {
+      row[ocommKeyType(findRegion(it->first.first), it->first.second)] += it->second;
+      it->second = 0;
     }
   }
+}
+
+
+VOID collapseLatency(latencyItemType & row) {
+  if (combine.empty())
+    return;
+  for(latencyItemType::iterator it = row.begin(); it != row.end(); ) {
+    if (combine.count(it->first)) {
+      latencyType & to = row[findRegion(it->first)];
+      for(int i = 0; i < LATENCY_BUCKETS; ++i)
+        to.bytes[i] += it->second.bytes[i];
+      row.erase(it++);
+    } else
+      ++it;
+  }
+}
+
+VOID collapseCache(cacheItemType & row) {
+  if (combine.empty())
+    return;
+  for(cacheItemType::iterator it = row.begin(); it != row.end(); ) {
+    if (combine.count(it->first)) {
+      cacheCountType & to = row[findRegion(it->first)];
+      for(int i = 0; i < CACHE_COUNTS; ++i)
+        to.count[i] += it->second.count[i];
+      row.erase(it++);
+    } else
+      ++it;
+  }
+}
+
+VOID mergeCache(UINT64 region, UINT64 parent) {
+  cacheCommType::iterator row = kcomm.find(region);
+  if (row == kcomm.end())
+    return;
+  for(cacheItemType::iterator it = row->second.begin(); it != row->second.end(); ++it) {
+    cacheCountType & to = kcomm[parent][it->first];
+    for(int i = 0; i < CACHE_COUNTS; ++i)
+      to.count[i] += it->second.count[i];
+  }
+  kcomm.erase(row);
+}
+
+VOID mergeLatency(UINT64 region, UINT64 parent) {
+  latencyCommType::iterator row = lcomm.find(region);
+  if (row == lcomm.end())
+    return;
+  for(latencyItemType::iterator it = row->second.begin(); it != row->second.end(); ++it) {
+    latencyType & to = lcomm[parent][it->first];
+    for(int i = 0; i < LATENCY_BUCKETS; ++i)
+      to.bytes[i] += it->second.bytes[i];
+  }
+  lcomm.erase(row);
+}
+
+
+/* start a new generation of the combine forest: rewrite everything that may still refer to a
+   collapsed region (shadow memory, pending communication) to its root, after which the forest
+   can be thrown away. Only done once the forest is a sizeable fraction of the shadow memory,
+   so its memory stays proportional to the footprint, and the walk over the shadow memory is
+   amortized over the collapses that caused it */
+VOID rollupRegions() {
+  if (combine.size() < COMBINE_ROLLUP || combine.size() < shadow.size() / 4)
+    return;
+  for(shadowMapType::iterator it = shadow.begin(); it != shadow.end(); ++it)
+    if (combine.count(it->second.lastwritten))
+      it->second.lastwritten = findRegion(it->second.lastwritten);
+  for(commType::iterator it = comm.begin(); it != comm.end(); ++it)
+    collapseComm(it->second);
+  for(ocommType::iterator it = ocomm.begin(); it != ocomm.end(); ++it)
+    collapseObjectComm(it->second);
+  for(latencyCommType::iterator it = lcomm.begin(); it != lcomm.end(); ++it)
+    collapseLatency(it->second);
+  for(cacheCommType::iterator it = kcomm.begin(); it != kcomm.end(); ++it)
+    collapseCache(it->second);
+  combine.clear();
+}
 
-  binstore_store_items(trace, "c", 'C');
-  storeRegion(trace, region);
+
+VOID storeComm(UINT64 region) {
+  collapseComm(comm[region]);
+
+  bs_put_char(&rec, 'C');
+  bs_put_region(&rec, region);
   for(std::map<UINT64, UINT64>::iterator it = comm[region].begin(); it != comm[region].end(); ++it) {
     if (it->first != region && it->second > 0) {
-    binstore_store_items(trace, "(");
-    storeRegion(trace, it->first);
-    binstore_store_items(trace, "l)", it->second);
+    bs_put_open(&rec);
+    bs_put_region(&rec, it->first);
+    bs_put_u64(&rec, it->second);
+    bs_put_close(&rec);
     }
   }
-  binstore_store_end(trace);
+  bs_end_record(trace, &rec);
 
   comm.erase(region);
+
+  /* -latency: 'H' <region> (<source region> <bucket> <bytes>)*, bucket b counts reads [2^(b-1), 2^b) instructions after the write */
+  if (lcomm.count(region)) {
+    collapseLatency(lcomm[region]);
+    bs_put_char(&rec, 'H');
+    bs_put_region(&rec, region);
+    for(latencyItemType::iterator it = lcomm[region].begin(); it != lcomm[region].end(); ++it) {
+      if (it->first == region)
+        continue;
+      for(int i = 0; i < LATENCY_BUCKETS; ++i)
+        if (it->second.bytes[i]) {
+          bs_put_open(&rec);
+          bs_put_region(&rec, it->first);
+          bs_put_u32(&rec, i);
+          bs_put_u64(&rec, it->second.bytes[i]);
+          bs_put_close(&rec);
+        }
+    }
+    bs_end_record(trace, &rec);
+    lcomm.erase(region);
+  }
+
+  /* -cache: 'K' <region> (<source region> <coherence misses> <capacity misses> <cold misses> <invalidations>)* */
+  if (kcomm.count(region)) {
+    collapseCache(kcomm[region]);
+    bs_put_char(&rec, 'K');
+    bs_put_region(&rec, region);
+    for(cacheItemType::iterator it = kcomm[region].begin(); it != kcomm[region].end(); ++it) {
+      if (it->first == region)
+        continue;
+      bs_put_open(&rec);
+      bs_put_region(&rec, it->first);
+      for(int i = 0; i < CACHE_COUNTS; ++i)
+        bs_put_u64(&rec, it->second.count[i]);
+      bs_put_close(&rec);
+    }
+    bs_end_record(trace, &rec);
+    kcomm.erase(region);
+  }
+
+  if (ocomm.count(region)) {
+    collapseObjectComm(ocomm[region]);
+    bs_put_char(&rec, 'O');
+    bs_put_region(&rec, region);
+    for(ocommItemType::iterator it = ocomm[region].begin(); it != ocomm[region].end(); ++it) {
+      if (it->first.first != region && it->second > 0) {
+        bs_put_open(&rec);
+        bs_put_region(&rec, it->first.first);
+        bs_put_u32(&rec, objects[it->first.second].objectid);
+        bs_put_u32(&rec, objects[it->first.second].site);
+        bs_put_u64(&rec, it->second);
+        bs_put_close(&rec);
+      }
+    }
+    bs_end_record(trace, &rec);
+    ocomm.erase(region);
+  }
+}
+
+
+/* -interval: write the matrix entries that changed since the last 'V' record:
+   'V' <seq> <icount> (<dst tid> <dst mregion> <src tid> <src mregion> <bytes>)*
+   a record of which the entries didn't fit in -intervalmax is continued by more records with the same <seq> */
+VOID storeInterval(BOOL done) {
+  bs_put_char(&rec, 'V');
+  bs_put_u32(&rec, interval_seq);
+  bs_put_u64(&rec, icount_tot);
+  for(intervalType::iterator it = imatrix.begin(); it != imatrix.end(); ++it) {
+    bs_put_open(&rec);
+    bs_put_u32(&rec, it->first.first & 0x3ff);
+    bs_put_u32(&rec, it->first.first >> 10);
+    bs_put_u32(&rec, it->first.second & 0x3ff);
+    bs_put_u32(&rec, it->first.second >> 10);
+    bs_put_u64(&rec, it->second);
+    bs_put_close(&rec);
+  }
+  bs_end_record(trace, &rec);
+  imatrix.clear();
+  if (done)
+    ++interval_seq;
+}
+
+
+/* -falseshare: write the -falsesharetop lines with most false sharing transfers, and forget all lines:
+   'L' <line address> <false sharing transfers> <true sharing transfers> <objectid> <site> (<funcid>)* */
+VOID storeFalseShare() {
+  std::vector<std::pair<UINT64, ADDRINT> > worst;
+  for(falseShareMapType::iterator it = fslines.begin(); it != fslines.end(); ++it)
+    if (it->second.transfers[0])
+      worst.push_back(std::make_pair(it->second.transfers[0], it->first));
+  size_t n = std::min(worst.size(), (size_t)KnobFalseShareTop.Value());
+  std::partial_sort(worst.begin(), worst.begin() + n, worst.end(), std::greater<std::pair<UINT64, ADDRINT> >());
+  for(size_t i = 0; i < n; ++i) {
+    falseShareType & fs = fslines[worst[i].second];
+    bs_put_char(&rec, 'L');
+    bs_put_u64(&rec, (UINT64)worst[i].second << FALSESHARE_LINE_BITS);
+    bs_put_u64(&rec, fs.transfers[0]);
+    bs_put_u64(&rec, fs.transfers[1]);
+    bs_put_u32(&rec, objects[fs.object].objectid);
+    bs_put_u32(&rec, objects[fs.object].site);
+    for(int w = 0; w < FALSESHARE_WRITERS && fs.writers[w]; ++w)
+      bs_put_u32(&rec, fs.writers[w]);
+    bs_end_record(trace, &rec);
+  }
+  fslines.clear();
+  if (falseshare_untracked) {
+    fprintf(stderr, "[PINCOMM] -falseshare: %" PRIu64 " accesses by threads %u and up were not tracked\n", falseshare_untracked, FALSESHARE_THREADS);
+    falseshare_untracked = 0;
+  }
+}
+
+
+/* -numa: write the pages accessed since START, and forget their counts:
+   'U' <page address> <first-touching thread> <objectid> <site> (<threadid> <mreg> <bytes read> <bytes written>)* */
+VOID storeNuma() {
+  for(numaPageMapType::iterator it = numapages.begin(); it != numapages.end(); ++it) {
+    numaPageType & pg = it->second;
+    if (pg.access.empty())
+      continue;
+    bs_put_char(&rec, 'U');
+    bs_put_u64(&rec, (UINT64)it->first << numa_page_bits);
+    bs_put_u32(&rec, pg.first);
+    bs_put_u32(&rec, objects[pg.object].objectid);
+    bs_put_u32(&rec, objects[pg.object].site);
+    for(std::vector<numaAccessType>::iterator a = pg.access.begin(); a != pg.access.end(); ++a) {
+      bs_put_open(&rec);
+      bs_put_u32(&rec, a->treg & 0x3ff);
+      bs_put_u32(&rec, a->treg >> 10);
+      bs_put_u64(&rec, a->read);
+      bs_put_u64(&rec, a->write);
+      bs_put_close(&rec);
+    }
+    bs_end_record(trace, &rec);
+    pg.access.clear();
+  }
+}
+
+
+/* -sync: write the sync objects used since START, and forget their counts:
+   'B' <address> <kind> <acquires> <handoffs> <sync bytes> <data bytes> */
+VOID storeSync() {
+  for(syncMapType::iterator it = syncs.begin(); it != syncs.end(); ++it) {
+    syncType & so = it->second;
+    if (!so.acquires && !so.syncbytes && !so.databytes)
+      continue;
+    bs_put_char(&rec, 'B');
+    bs_put_u64(&rec, it->first);
+    bs_put_u32(&rec, so.kind);
+    bs_put_u64(&rec, so.acquires);
+    bs_put_u64(&rec, so.handoffs);
+    bs_put_u64(&rec, so.syncbytes);
+    bs_put_u64(&rec, so.databytes);
+    bs_end_record(trace, &rec);
+    so.acquires = so.handoffs = so.syncbytes = so.databytes = 0;
+  }
+}
+
+
+/* -hotloads: merge the per-thread tables and write the -hotloadstop loads with most communication:
+   'D' <funcid> <pc> <bytes> <loads> <misses> <file> <line> */
+VOID storeHotLoads() {
+  pcCountMapType total;
+  for(int tid = 0; tid < MAX_THREADS; ++tid) {
+    for(pcCountMapType::iterator it = pccount[tid].begin(); it != pccount[tid].end(); ++it) {
+      pcCountType & pc = total[it->first];
+      pc.bytes += it->second.bytes;
+      pc.loads += it->second.loads;
+      pc.misses += it->second.misses;
+      pc.funcid = it->second.funcid;
+    }
+    pccount[tid].clear();
+  }
+  std::vector<std::pair<UINT64, ADDRINT> > hot;
+  for(pcCountMapType::iterator it = total.begin(); it != total.end(); ++it)
+    hot.push_back(std::make_pair(it->second.bytes, it->first));
+  size_t n = std::min(hot.size(), (size_t)KnobHotLoadsTop.Value());
+  std::partial_sort(hot.begin(), hot.begin() + n, hot.end(), std::greater<std::pair<UINT64, ADDRINT> >());
+  for(size_t i = 0; i < n; ++i) {
+    pcCountType & pc = total[hot[i].second];
+    INT32 line; string fileName;
+    PIN_GetSourceLocation(hot[i].second, NULL, &line, &fileName);
+    bs_put_char(&rec, 'D');
+    bs_put_u32(&rec, pc.funcid);
+    bs_put_u64(&rec, hot[i].second);
+    bs_put_u64(&rec, pc.bytes);
+    bs_put_u64(&rec, pc.loads);
+    bs_put_u64(&rec, pc.misses);
+    bs_put_str(&rec, fileName.c_str());
+    bs_put_u32(&rec, line);
+    bs_end_record(trace, &rec);
+  }
 }
 
 
 void StateMeasureStart(string why)
 {
   L();
-  binstore_store(trace, "s", "START");
+  bs_put_str(&rec, "START");
+  bs_end_record(trace, &rec);
   fprintf(stdout, "[PINCOMM] Start: %s\n", why.c_str());
   fflush(stdout);
   state = S_MEASURE;
+  icount_tot = 0;
+  epoch = 0;
+  stats_next = KnobStats.Value();
+  interval_next = KnobInterval.Value();
+  imatrix.clear();
+  fslines.clear();
+  for(int tid = 0; tid < MAX_THREADS; ++tid)
+    pccount[tid].clear();
   for(callStackType::iterator it = callStack.begin(); it != callStack.end(); ++it) {
-    icount[it->first] = 0;
+    tcount[it->first].icount = tcount[it->first].icount_flushed = 0;
     printStack(it->first);
     setRegion(it->first);
   }
-  icount_tot = 0;
-  icount_next = KnobRegionTime.Value();
   U();
 }
 
@@ -271,18 +885,36 @@ void StateMeasureStop(string why)
 {
   L();
   for(int tid = 0; tid < MAX_THREADS; ++tid)
-    if (icount[tid])
-      binstore_store(trace, "cil", 'I', tid, icount[tid]);
+    if (tcount[tid].icount) {
+      bs_put_char(&rec, 'I');
+      bs_put_u32(&rec, tid);
+      bs_put_u64(&rec, tcount[tid].icount);
+      bs_end_record(trace, &rec);
+    }
 
   for(callStackType::iterator it = callStack.begin(); it != callStack.end(); ++it) {
     while(!it->second.empty())
       RecordReturn(it->first /* threadid */, 0, 0);
   }
 
-  for(commType::iterator it = comm.begin(); it != comm.end(); ++it)
-    storeComm(it->first);
-
-  binstore_store(trace, "s", "STOP");
+  while(!comm.empty())
+    storeComm(comm.begin()->first);  /* storeComm() erases the entry */
+  while(!kcomm.empty())
+    storeComm(kcomm.begin()->first); /* invalidations of regions that had no communication */
+
+  if (KnobInterval.Value())
+    storeInterval(TRUE);
+  if (KnobFalseShare.Value())
+    storeFalseShare();
+  if (KnobHotLoads.Value())
+    storeHotLoads();
+  if (donuma)
+    storeNuma();
+  if (dosync)
+    storeSync();
+
+  bs_put_str(&rec, "STOP");
+  bs_end_record(trace, &rec);
   fprintf(stdout, "[PINCOMM] Stop: %s\n", why.c_str());
   fflush(stdout);
   U();
@@ -294,7 +926,8 @@ void StateMeasureEnd(BOOL theEnd)
   if (state == S_MEASURE)
     StateMeasureStop("ending");
   L();
-  binstore_store(trace, "s", "END");
+  bs_put_str(&rec, "END");
+  bs_end_record(trace, &rec);
   fprintf(stdout, "[PINCOMM] End\n");
   fflush(stdout);
   state = S_DONE;
@@ -304,16 +937,92 @@ void StateMeasureEnd(BOOL theEnd)
 }
 
 
+/* the allocations in [start, end) changed, drop the cached lookups that overlap it */
+VOID objectInvalidate(ADDRINT start, ADDRINT end)
+{
+  for(std::vector<THREADID>::iterator t = objCacheThreads.begin(); t != objCacheThreads.end(); ++t) {
+    objCacheType & c = objCache[*t];
+    if (c.start < end && start < c.end)
+      c.valid = FALSE;
+  }
+}
+
+
+/* forget allocations overlapping [start, end) */
+VOID objectRemove(ADDRINT start, ADDRINT end)
+{
+  objRangesType::iterator it = objranges.upper_bound(start);
+  if (it != objranges.begin() && (--it)->second.first <= start)
+    ++it;
+  while(it != objranges.end() && it->first < end) {
+    objectInvalidate(it->first, it->second.first);
+    objranges.erase(it++);
+  }
+}
+
+
+VOID objectInsert(ADDRINT objectid, ADDRINT site, ADDRINT address, ADDRINT size)
+{
+  std::pair<UINT32, ADDRINT> key(objectid, site);
+  UINT32 & index = objectIndex[key];
+  if (!index) {
+    index = objects.size();
+    objectType o = { (UINT32)objectid, site };
+    objects.push_back(o);
+  }
+  objectRemove(address, address + size);
+  objranges[address] = std::make_pair(address + size, index);
+  objectInvalidate(address, address + size);
+}
+
+
+/* object written at <addr>, 0 if none */
+inline UINT32 objectFind(THREADID threadid, ADDRINT addr)
+{
+  objCacheType & c = objCache[threadid];
+  if (c.valid && addr >= c.start && addr < c.end)
+    return c.object;
+  /* remember the object, or the gap between objects, that contains addr */
+  if (!c.valid && !c.end)
+    objCacheThreads.push_back(threadid);
+  c.valid = TRUE;
+  objRangesType::iterator it = objranges.upper_bound(addr);
+  c.end = it == objranges.end() ? ~(ADDRINT)0 : it->first;
+  c.start = 0;
+  c.object = 0;
+  if (it != objranges.begin()) {
+    --it;
+    if (addr < it->second.first) {
+      c.start = it->first;
+      c.end = it->second.first;
+      c.object = it->second.second;
+    } else
+      c.start = it->second.first;
+  }
+  return c.object;
+}
+
+
 VOID LogMalloc(THREADID threadid, ADDRINT objectid, ADDRINT returnIp, ADDRINT address, ADDRINT size)
 {
   outputSelfAndParents(threadid);
-  binstore_store(trace, "ciiiii", 'M', threadid, objectid, returnIp, address, size);
+  BINSTORE_RECORD * r = &trec[threadid];
+  bs_put_char(r, 'M');
+  bs_put_u32(r, threadid);
+  bs_put_u32(r, objectid);
+  bs_put_u32(r, returnIp);
+  bs_put_u32(r, address);
+  bs_put_u32(r, size);
+  bs_end_record(trace, r);
+  if (doobjects && size)
+    objectInsert(objectid, returnIp, address, size);
 }
 
 
 VOID Magic(THREADID threadid, INT32 arg, INT32 arg1, INT32 arg2)
 {
   int cmd = (arg & __PIN_CMD_MASK) >> __PIN_CMD_OFFSET, val = arg & __PIN_ID_MASK;
+  STAT(threadid, STAT_MAGIC);
 
   if (KnobUseMagic) {
     /* program was compiled with Simics' MAGIC instruction,
@@ -358,13 +1067,19 @@ VOID Magic(THREADID threadid, INT32 arg, INT32 arg1, INT32 arg2)
       break;
     case __PIN_MAGIC_MALLOCM:
       // fprintf(stdout, "[PINCOMM] Object #%u @ %x+%u\n", val, arg1, arg2); fflush(stdout);
+      L();
       LogMalloc(threadid, val /* objectid */, callStack[threadid].back().funcid /* returnIp */, arg1 /* address */, arg2 /*size */);
+      U();
       break;
     case __PIN_MAGIC_REGION:
       if (state == S_MEASURE) {
         L();
         outputSelfAndParents(threadid);
-        binstore_store(trace, "ciil", 'G', threadid, val, icount[threadid]);
+        bs_put_char(&trec[threadid], 'G');
+        bs_put_u32(&trec[threadid], threadid);
+        bs_put_u32(&trec[threadid], val);
+        bs_put_u64(&trec[threadid], tcount[threadid].icount);
+        bs_end_record(trace, &trec[threadid]);
         safeThreadId(threadid);
         if (val > MAX_MREGION) {
           fprintf(stderr, "[PINCOMM] Got MREGION(%u) > MAX_MREGION(%u) !!\n", val, MAX_MREGION);
@@ -392,57 +1107,505 @@ VOID Magic(THREADID threadid, INT32 arg, INT32 arg1, INT32 arg2)
   }
 }
 
+/* -stats: write a 'P' record, or a summary to stderr */
+VOID storeStats(BOOL summary)
+{
+  UINT64 calls[STAT_NUM] = { 0 }, lockwait = 0, commentries = 0, tracebytes = 0, tracebytes_gz = 0;
+  for(int tid = 0; tid < MAX_THREADS; ++tid) {
+    for(int i = 0; i < STAT_NUM; ++i)
+      calls[i] += tstats[tid].calls[i];
+    lockwait += tstats[tid].lockwait;
+  }
+  for(commType::iterator it = comm.begin(); it != comm.end(); ++it)
+    commentries += it->second.size();
+  /* map nodes carry a color and three pointers besides the data */
+  UINT64 shadowbytes = shadow.size() * (sizeof(shadowMapType::value_type) + 4 * sizeof(void *))
+                      + only_shadow.leaves * PAGETABLE_SIZE * sizeof(UINT32)
+                      + cache_sharers.leaves * PAGETABLE_SIZE * sizeof(UINT64);
+  binstore_stats(trace, &tracebytes, &tracebytes_gz);
+
+  if (summary) {
+    fprintf(stderr, "[PINCOMM] Stats: %"PRIu64" instructions\n", icount_tot);
+    for(int i = 0; i < STAT_NUM; ++i)
+      fprintf(stderr, "[PINCOMM] Stats: %-8s %"PRIu64" calls\n", statNames[i], calls[i]);
+    fprintf(stderr, "[PINCOMM] Stats: lock wait %"PRIu64" cycles (%.1f per acquisition)\n",
+      lockwait, calls[STAT_LOCK] ? (double)lockwait / calls[STAT_LOCK] : 0.);
+    fprintf(stderr, "[PINCOMM] Stats: shadow memory %"PRIu64" entries, %"PRIu64" bytes\n", (UINT64)shadow.size(), shadowbytes);
+    fprintf(stderr, "[PINCOMM] Stats: comm %"PRIu64" rows, %"PRIu64" entries\n", (UINT64)comm.size(), commentries);
+    fprintf(stderr, "[PINCOMM] Stats: trace %"PRIu64" bytes, %"PRIu64" compressed\n", tracebytes, tracebytes_gz);
+  } else {
+    UINT64 values[] = { lockwait, shadow.size(), shadowbytes, comm.size(), commentries, tracebytes, tracebytes_gz, objranges.size() };
+    bs_put_char(&rec, 'P');
+    bs_put_u64(&rec, icount_tot);
+    for(int i = 0; i < STAT_NUM; ++i)
+      bs_put_u64(&rec, calls[i]);
+    for(unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+      bs_put_u64(&rec, values[i]);
+    bs_end_record(trace, &rec);
+  }
+}
+
+
+/* -skip, -length, -windows: start or stop measuring if we are at a window's edge */
+VOID checkWindow(UINT64 run)
+{
+  L();
+  if (state == S_INIT && window < windows.size() && run >= windows[window].first) {
+    /* the call stacks are stale after fast-forwarding, checkFunc() rebuilds them as threads run */
+    for(callStackType::iterator it = callStack.begin(); it != callStack.end(); ++it)
+      it->second.clear();
+    fastforward = FALSE;
+    StateMeasureStart("window start");
+    PIN_RemoveInstrumentation();
+  } else if (state == S_MEASURE && run >= windows[window].second) {
+    StateMeasureStop("window end");
+    if (++window == windows.size())
+      StateMeasureEnd(FALSE);  /* detaches, nothing left to measure */
+    else {
+      fastforward = TRUE;
+      PIN_RemoveInstrumentation();
+    }
+  }
+  U();
+}
+
+
 VOID CountInstructions(THREADID threadid, INT32 count) {
   safeThreadId(threadid);
-  icount[threadid] += count;
-  icount_tot += count;
+  STAT(threadid, STAT_BBL);
+  threadCountType & tc = tcount[threadid];
+  tc.icount += count;
+  if (tc.icount - tc.icount_flushed >= icount_flush) {
+    if (!windows.empty()) {
+      UINT64 run = __sync_add_and_fetch(&icount_run, tc.icount - tc.icount_flushed);
+      if (window < windows.size() && run >= (state == S_MEASURE ? windows[window].second : windows[window].first))
+        checkWindow(run);
+    }
+    UINT64 tot = __sync_add_and_fetch(&icount_tot, tc.icount - tc.icount_flushed);
+    tc.icount_flushed = tc.icount;
+    if (KnobRegionTime.Value()) {
+      UINT64 e = tot / KnobRegionTime.Value(), old;
+      while((old = epoch) < e && !__sync_bool_compare_and_swap(&epoch, old, e))
+        ;
+    }
+    if (KnobInterval.Value() && tot >= interval_next && state == S_MEASURE) {
+      L();
+      if (tot >= interval_next) {
+        storeInterval(TRUE);
+        interval_next = (tot / KnobInterval.Value() + 1) * KnobInterval.Value();
+      }
+      U();
+    }
+    if (dostats && tot >= stats_next && state == S_MEASURE) {
+      L();
+      if (tot >= stats_next) {
+        storeStats(FALSE);
+        stats_next = tot + KnobStats.Value();
+      }
+      U();
+    }
+  }
 }
 
 
-// Print a memory read record
-VOID RecordMemRead(THREADID threadid, UINT32 funcid, ADDRINT sp, ADDRINT addr, ADDRINT size)
+/* -latency: global instruction count as seen by this thread (off by at most the unflushed counts of the others) */
+inline UINT64 icountNow(THREADID threadid) {
+  return icount_tot + tcount[threadid].icount - tcount[threadid].icount_flushed;
+}
+
+/* bucket b holds distances in [2^(b-1), 2^b) */
+inline int latencyBucket(UINT64 distance) {
+  int b = distance ? 64 - __builtin_clzll(distance) : 0;
+  return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+
+/* -falseshare: update the lines touched by an access of <size> bytes at <addr> */
+VOID falseShareAccess(THREADID threadid, UINT32 funcid, ADDRINT addr, ADDRINT size, BOOL write, UINT32 object)
+{
+  const ADDRINT linesize = 1 << FALSESHARE_LINE_BITS;
+  if (threadid >= FALSESHARE_THREADS) {
+    ++falseshare_untracked;
+    return;
+  }
+  const UINT64 self = (UINT64)1 << threadid;
+  for(ADDRINT line = addr >> FALSESHARE_LINE_BITS; line <= (addr + size - 1) >> FALSESHARE_LINE_BITS; ++line) {
+    ADDRINT start = std::max(addr, line << FALSESHARE_LINE_BITS),
+           end = std::min(addr + size, (line + 1) << FALSESHARE_LINE_BITS);
+    UINT64 mask = end - start == linesize ? ~(UINT64)0 : (((UINT64)1 << (end - start)) - 1) << (start & (linesize - 1));
+
+    falseShareType * fs;
+    if (write)
+      fs = &fslines[line];
+    else {
+      falseShareMapType::iterator it = fslines.find(line);
+      if (it == fslines.end())
+        continue;
+      fs = &it->second;
+    }
+
+    /* the line comes from another thread if we don't have a copy of it, and someone else wrote it */
+    int me = FALSESHARE_OWNERS;
+    BOOL other = (fs->olderby & ~self) != 0, overlap = other && (fs->older & mask) != 0;
+    for(int o = 0; o < FALSESHARE_OWNERS && fs->owners[o]; ++o)
+      if (fs->owners[o] == threadid + 1)
+        me = o;
+      else {
+        other = TRUE;
+        overlap |= (fs->masks[o] & mask) != 0;
+      }
+    if (!(fs->copies & self) && other) {
+      ++fs->transfers[overlap];
+      if (me < FALSESHARE_OWNERS)
+        fs->masks[me] = 0;
+    }
+    fs->copies |= self;
+    if (!write)
+      continue;
+
+    /* we become the most recent writer, the others lose their copies */
+    UINT64 mine = me < FALSESHARE_OWNERS ? fs->masks[me] : 0;
+    if (me == FALSESHARE_OWNERS && fs->owners[FALSESHARE_OWNERS - 1]) {
+      fs->olderby |= (UINT64)1 << (fs->owners[FALSESHARE_OWNERS - 1] - 1);
+      fs->older |= fs->masks[FALSESHARE_OWNERS - 1];
+    }
+    for(int o = std::min(me, FALSESHARE_OWNERS - 1); o > 0; --o) {
+      fs->owners[o] = fs->owners[o - 1];
+      fs->masks[o] = fs->masks[o - 1];
+    }
+    fs->owners[0] = threadid + 1;
+    fs->masks[0] = mine | mask;
+    fs->copies = self;
+    fs->object = object;
+    if (fs->writers[0] != funcid) {
+      int w = 1;
+      while(w < FALSESHARE_WRITERS - 1 && fs->writers[w] != funcid)
+        ++w;
+      for(; w > 0; --w)
+        fs->writers[w] = fs->writers[w - 1];
+      fs->writers[0] = funcid;
+    }
+  }
+}
+
+
+VOID regionOnlyHashAdd(regionOnlyType & r, UINT64 key, UINT64 bytes)
+{
+  if (2 * (r.used + 1) > r.size) {
+    /* keep the table at most half full */
+    UINT64 size = r.size ? 2 * r.size : 1024, * keys = r.keys, * values = r.values;
+    r.keys = new UINT64[size]();
+    r.values = new UINT64[size]();
+    std::swap(r.size, size);
+    r.used = 0;
+    for(UINT64 i = 0; i < size; ++i)
+      if (keys[i])
+        regionOnlyHashAdd(r, keys[i], values[i]);
+    delete [] keys;
+    delete [] values;
+  }
+  UINT64 i = (key * 0x9e3779b97f4a7c15ULL) >> 32 & (r.size - 1);
+  while(r.keys[i] && r.keys[i] != key)
+    i = (i + 1) & (r.size - 1);
+  if (!r.keys[i]) {
+    r.keys[i] = key;
+    ++r.used;
+  }
+  r.values[i] += bytes;
+}
+
+inline void regionOnlyAdd(regionOnlyType & r, UINT32 src, UINT32 dst, UINT64 bytes)
+{
+  if (src < REGIONONLY_DENSE && dst < REGIONONLY_DENSE) {
+    if (!r.dense)
+      r.dense = new UINT64[REGIONONLY_DENSE][REGIONONLY_DENSE]();
+    r.dense[src][dst] += bytes;
+  } else
+    regionOnlyHashAdd(r, (UINT64)src << 32 | dst, bytes);
+}
+
+/* number of bytes of the access [addr, addr + size) that fall in granule <a> */
+inline ADDRINT granuleBytes(ADDRINT a, ADDRINT addr, ADDRINT size)
+{
+  ADDRINT s = 1 << memgran_bits;
+  if (a == addr >> memgran_bits)
+    s -= (addr - (a << memgran_bits));
+  if (a == (addr + size - 1) >> memgran_bits)
+    s -= ((a + 1) << memgran_bits) - (addr + size);
+  return s;
+}
+
+
+/* -cache: the set of <line> in the cache of <threadid> */
+inline UINT64 * cacheSet(THREADID threadid, UINT64 line)
+{
+  if (!caches[threadid]) {
+    caches[threadid] = new UINT64[cache_sets * cache_assoc]();
+    if (threadid >= CACHE_THREADS)
+      cacheUntracked.push_back(threadid);
+  }
+  return caches[threadid] + (line & (cache_sets - 1)) * cache_assoc;
+}
+
+/* -cache: access <line> from <threadid>, which makes it the most recently used line of its set */
+inline int cacheAccess(THREADID threadid, UINT64 line)
+{
+  UINT64 * set = cacheSet(threadid, line), tag = line + 1;
+  UINT32 w = 0;
+  while(w < cache_assoc && (set[w] & ~CACHE_INVALID) != tag)
+    ++w;
+  int result = w == cache_assoc ? CACHE_MISS : set[w] & CACHE_INVALID ? CACHE_INVALIDATED : CACHE_HIT;
+  if (w == cache_assoc) {
+    --w;  /* evict the least recently used line */
+    if (threadid < CACHE_THREADS && set[w] && !(set[w] & CACHE_INVALID))
+      *pagetable_slot64(&cache_sharers, set[w] - 1, 1) &= ~((UINT64)1 << threadid);
+  }
+  if (result != CACHE_HIT && threadid < CACHE_THREADS)
+    *pagetable_slot64(&cache_sharers, line, 1) |= (UINT64)1 << threadid;
+  memmove(set + 1, set, w * sizeof(UINT64));
+  set[0] = tag;
+  return result;
+}
+
+/* -cache: invalidate <line> in the cache of <other> because region <reg> wrote it */
+inline void cacheInvalidate(THREADID other, UINT64 reg, UINT64 line)
+{
+  UINT64 * set = caches[other] + (line & (cache_sets - 1)) * cache_assoc, tag = line + 1;
+  for(UINT32 w = 0; w < cache_assoc; ++w)
+    if (set[w] == tag) {
+      set[w] |= CACHE_INVALID;
+      ++kcomm[tcount[other].region][reg].count[CACHE_INVALIDATION];
+      break;
+    }
+}
+
+/* -cache: <threadid> in region <reg> read [addr, addr + size), count its misses by the region that wrote the data */
+VOID cacheRead(THREADID threadid, UINT64 reg, ADDRINT addr, ADDRINT size)
+{
+  for(UINT64 line = addr >> cache_line_bits; line <= (addr + size - 1) >> cache_line_bits; ++line) {
+    int result = cacheAccess(threadid, line);
+    if (result == CACHE_HIT)
+      continue;
+    ADDRINT first = std::max(addr, (ADDRINT)(line << cache_line_bits));
+    shadowMapType::iterator sh = shadow.find(first >> memgran_bits);
+    UINT64 src = sh == shadow.end() ? 0 : sh->second.lastwritten;
+    int kind = CACHE_COLD;
+    if (result == CACHE_INVALIDATED)
+      kind = CACHE_COHERENCE;
+    /* we had the line before if we wrote it, or read it since it was last written */
+    else if (sh != shadow.end() && ((src && (src & 0x3ff) == threadid) || (sh->second.readby & readbyBit(threadid))))
+      kind = CACHE_CAPACITY;
+    ++kcomm[reg][src].count[kind];
+  }
+}
+
+/* -cache: <threadid> in region <reg> wrote [addr, addr + size), take the lines away from all other caches */
+VOID cacheWrite(THREADID threadid, UINT64 reg, ADDRINT addr, ADDRINT size)
+{
+  for(UINT64 line = addr >> cache_line_bits; line <= (addr + size - 1) >> cache_line_bits; ++line) {
+    cacheAccess(threadid, line);
+    UINT64 self = threadid < CACHE_THREADS ? (UINT64)1 << threadid : 0;
+    volatile UINT64 * sharers = pagetable_slot64(&cache_sharers, line, 0);
+    if (sharers) {
+      for(UINT64 others = *sharers & ~self; others; others &= others - 1)
+        cacheInvalidate(__builtin_ctzll(others), reg, line);
+      *sharers = self;
+    }
+    for(std::vector<THREADID>::iterator t = cacheUntracked.begin(); t != cacheUntracked.end(); ++t)
+      if (*t != threadid)
+        cacheInvalidate(*t, reg, line);
+  }
+}
+
+
+/* -numa: the entry of <page>, which <threadid> touches first if there is none yet */
+inline numaPageType * numaPage(THREADID threadid, ADDRINT addr, ADDRINT page)
+{
+  numaCacheType & c = numaCache[threadid];
+  if (!c.entry || c.page != page) {
+    numaPageMapType::iterator it = numapages.find(page);
+    if (it == numapages.end()) {
+      it = numapages.insert(std::make_pair(page, numaPageType())).first;
+      it->second.first = threadid;
+      it->second.object = objectFind(threadid, std::max(addr, page << numa_page_bits));
+    }
+    c.page = page;
+    c.entry = &it->second;
+  }
+  return c.entry;
+}
+
+/* -numa: <threadid> accessed [addr, addr + size) outside START/STOP, only the first touches are recorded.
+   Takes the client lock, but not when the thread stays on the page it looked up last */
+VOID numaTouch(THREADID threadid, ADDRINT addr, ADDRINT size)
+{
+  for(ADDRINT page = addr >> numa_page_bits; page <= (addr + size - 1) >> numa_page_bits; ++page) {
+    if (numaCache[threadid].entry && numaCache[threadid].page == page)
+      continue;
+    L();
+    numaPage(threadid, addr, page);
+    U();
+  }
+}
+
+/* -numa: <threadid> in region <reg> accessed [addr, addr + size) */
+VOID numaAccess(THREADID threadid, UINT64 reg, ADDRINT addr, ADDRINT size, BOOL write)
+{
+  UINT32 treg = reg & 0xffffffff;
+  for(ADDRINT page = addr >> numa_page_bits; page <= (addr + size - 1) >> numa_page_bits; ++page) {
+    std::vector<numaAccessType> & access = numaPage(threadid, addr, page)->access;
+    size_t i = 0;
+    while(i < access.size() && access[i].treg != treg)
+      ++i;
+    if (i == access.size()) {
+      numaAccessType a = { treg, 0, 0 };
+      access.push_back(a);
+    }
+    ADDRINT bytes = std::min(addr + size, (page + 1) << numa_page_bits) - std::max(addr, page << numa_page_bits);
+    if (write)
+      access[i].write += bytes;
+    else
+      access[i].read += bytes;
+  }
+}
+
+
+/* -sync: <threadid> read [addr, addr + size) inside a sync routine working on <object>, or <object> is a futex
+   word, count what it got from other threads as traffic of the sync object instead of as communication */
+VOID syncRead(THREADID threadid, ADDRINT object, ADDRINT addr, ADDRINT size)
+{
+  syncType & so = syncs[object];
+  for(ADDRINT a = addr >> memgran_bits; a <= (addr + size - 1) >> memgran_bits; ++a) {
+    shadowType & sh = shadow[a];
+    if (sh.lastwritten && threadid != (UINT32)(sh.lastwritten & 0x3ff))
+      so.syncbytes += granuleBytes(a, addr, size);
+    sh.readby |= readbyBit(threadid);
+  }
+}
+
+
+/* recompute our region if another -regiontime slice has started */
+inline void checkEpoch(THREADID threadid) {
+  if (tcount[threadid].epoch != epoch)
+    setRegion(threadid);
+}
+
+
+/* checkEpoch() for callers that don't hold the client lock: only take it if the region has to change */
+inline void checkEpochLocking(THREADID threadid) {
+  if (tcount[threadid].epoch != epoch) {
+    L();
+    setRegion(threadid);
+    U();
+  }
+}
+
+
+/* -shmring: leave the access to pincommring, only the region change needs the client lock */
+inline VOID ringAccess(THREADID threadid, ADDRINT addr, ADDRINT size, UINT32 type)
+{
+  checkEpochLocking(threadid);
+  if (threadid >= shmring->hdr->nrings) {
+    fprintf(stderr, "[PINCOMM] Thread %u has no shared memory ring, start pincommring with more rings\n", threadid);
+    exit(-1);
+  }
+  shmring_push(shmring, threadid, addr, size, type, tcount[threadid].region);
+}
+
+
+// Print a memory read record, <ip> is only passed with -hotloads
+inline VOID memRead(THREADID threadid, UINT32 funcid, ADDRINT sp, ADDRINT addr, ADDRINT size, ADDRINT ip)
 {
-  if (state != S_MEASURE) return;
+  STAT(threadid, STAT_READ);
+  if (state != S_MEASURE) {
+    if (donuma)
+      numaTouch(threadid, addr, size);  /* pages are placed by their first touch, also when it was before START */
+    return;
+  }
   checkFunc(threadid, funcid, sp);
+  if (shmring) {
+    ringAccess(threadid, addr, size, SHMRING_READ);
+    return;
+  }
+  if (KnobRegionOnly.Value()) {
+    /* only the region to region matrix is needed, skip everything else; no client lock unless our region changes */
+    checkEpochLocking(threadid);
+    regionOnlyType & ro = only_region[threadid];
+    UINT32 dst = (tcount[threadid].region >> 10) & 0x3fffff;
+    for(ADDRINT a = addr >> memgran_bits; a <= (addr + size - 1) >> memgran_bits; ++a)
+      regionOnlyAdd(ro, pagetable_get(&only_shadow, a), dst, granuleBytes(a, addr, size));
+    return;
+  }
   L();
   //binstore_store(trace, "ciii", 'R', threadid, addr, size);
+  checkEpoch(threadid);
+
+  //binstore_store(trace, "clli", 'C', lastwritten[addr], region[threadid], size);
+  UINT64 reg = region[threadid];
 
-  if (icount_tot > icount_next) {
-    icount_next += KnobRegionTime.Value();
-    for(callStackType::iterator it = callStack.begin(); it != callStack.end(); ++it) {
-      setRegion(it->first);
+  if (dosync && syncPending[threadid].depth) {
+    syncRead(threadid, syncPending[threadid].object, addr, size);
+    U();
+    return;
+  }
+  if (dosync && !futexWords.empty()) {
+    /* a futex word is 4 bytes: the first one that ends after addr */
+    std::set<ADDRINT>::iterator w = futexWords.lower_bound(addr < 3 ? 0 : addr - 3);
+    if (w != futexWords.end() && *w < addr + size) {
+      syncRead(threadid, *w, addr, size);
+      U();
+      return;
     }
   }
 
-  //binstore_store(trace, "clli", 'C', lastwritten[addr], region[threadid], size);
+  /* before the shadow memory's readby bits are updated */
+  if (docache)
+    cacheRead(threadid, reg, addr, size);
+
+  UINT64 now = KnobLatency.Value() ? icountNow(threadid) : 0;
   int commBytes = 0, isComm = false, commBytes_cache = 0, isComm_cache = false;
   for(ADDRINT a = addr >> memgran_bits; a <= (addr + size - 1) >> memgran_bits; ++a) {
-    ADDRINT s = 1 << memgran_bits;
-    if (a == addr >> memgran_bits)
-      s -= (addr - (a << memgran_bits));
-    if (a == (addr + size - 1) >> memgran_bits)
-      s -= ((a + 1) << memgran_bits) - (addr + size);
-
-    if (KnobRegionOnly.Value()) {
-      UINT64 src = (lastwritten[a] >> 10) & 0xff,
-             dst = (region[threadid] >> 10) & 0xff;
-      if (only_region.count(src) == 0)      only_region[src] = std::map<UINT64, UINT64>();
-      if (only_region[src].count(dst) == 0) only_region[src][dst] = 0;
-      only_region[src][dst] += s;
-    }
-
-    comm[region[threadid]][lastwritten[a]] += s;
-    if (s && lastwritten[a]
-        && threadid != (UINT32)(lastwritten[a] & 0x3ff))
+    ADDRINT s = granuleBytes(a, addr, size);
+    shadowType & sh = shadow[a];
+
+    comm[reg][sh.lastwritten] += s;
+    if (KnobInterval.Value() && sh.lastwritten)
+      imatrix[std::make_pair((UINT32)reg, (UINT32)sh.lastwritten)] += s;
+    if (KnobLatency.Value() && sh.lastwritten) {
+      UINT64 written = writetime[a];
+      lcomm[reg][sh.lastwritten].bytes[latencyBucket(now > written ? now - written : 0)] += s;
+    }
+    if (sh.object)
+      ocomm[reg][ocommKeyType(sh.lastwritten, sh.object)] += s;
+    if (s && sh.lastwritten
+        && threadid != (UINT32)(sh.lastwritten & 0x3ff))
     {
       isComm = TRUE;
       commBytes += s;
-      if (!(readby[a] & (1 << threadid))) {
+      if (!(sh.readby & readbyBit(threadid))) {
         isComm_cache = true;
         commBytes_cache += 1 << memgran_bits;
       }
     }
-    readby[a] |= 1 << threadid;
+    sh.readby |= readbyBit(threadid);
+  }
+  if (imatrix.size() > KnobIntervalMax.Value())
+    storeInterval(FALSE);
+  if (KnobFalseShare.Value())
+    falseShareAccess(threadid, funcid, addr, size, FALSE, 0);
+  if (donuma)
+    numaAccess(threadid, reg, addr, size, FALSE);
+  if (ip && isComm) {
+    pcCountType & pc = pccount[threadid][ip];
+    pc.bytes += commBytes;
+    ++pc.loads;
+    if (isComm_cache) ++pc.misses;
+    pc.funcid = funcid;
+  }
+  if (dosync && isComm) {
+    ADDRINT episode = syncHeld[threadid].empty() ? syncEpisode[threadid] : syncHeld[threadid].back();
+    if (episode)
+      syncs[episode].databytes += commBytes;
   }
   if (isComm) ++icount_read;
   if (isComm_cache) ++icount_read_cache;
@@ -451,18 +1614,58 @@ VOID RecordMemRead(THREADID threadid, UINT32 funcid, ADDRINT sp, ADDRINT addr, A
   U();
 }
 
+VOID RecordMemRead(THREADID threadid, UINT32 funcid, ADDRINT sp, ADDRINT addr, ADDRINT size)
+{
+  memRead(threadid, funcid, sp, addr, size, 0);
+}
+
+VOID RecordMemReadPC(THREADID threadid, UINT32 funcid, ADDRINT sp, ADDRINT addr, ADDRINT size, ADDRINT ip)
+{
+  memRead(threadid, funcid, sp, addr, size, ip);
+}
+
 // Print a memory write record
 VOID RecordMemWrite(THREADID threadid, UINT32 funcid, ADDRINT sp, ADDRINT addr, ADDRINT size)
 {
-  if (state != S_MEASURE) return;
+  STAT(threadid, STAT_WRITE);
+  if (state != S_MEASURE) {
+    if (donuma)
+      numaTouch(threadid, addr, size);
+    return;
+  }
   checkFunc(threadid, funcid, sp);
+  if (shmring) {
+    ringAccess(threadid, addr, size, SHMRING_WRITE);
+    return;
+  }
+  if (KnobRegionOnly.Value()) {
+    checkEpochLocking(threadid);
+    UINT32 src = (tcount[threadid].region >> 10) & 0x3fffff;
+    for(ADDRINT a = addr >> memgran_bits; a <= (addr + size - 1) >> memgran_bits; ++a)
+      pagetable_set(&only_shadow, a, src);
+    return;
+  }
   L();
   //binstore_store(trace, "ciii", 'W', threadid, addr, size);
+  checkEpoch(threadid);
 
+  UINT64 reg = region[threadid];
+  UINT32 object = doobjects ? objectFind(threadid, addr) : 0;
+  UINT64 now = KnobLatency.Value() ? icountNow(threadid) : 0;
+  if (docache)
+    cacheWrite(threadid, reg, addr, size);
   for(ADDRINT a = addr >> memgran_bits; a <= (addr + size - 1) >> memgran_bits; ++a) {
-    lastwritten[a] = region[threadid];
-    readby[a] = 0;
+    shadowType & sh = shadow[a];
+    sh.lastwritten = reg;
+    sh.readby = 0;
+    sh.object = KnobObjects.Value() ? object : 0;
+    if (KnobLatency.Value())
+      writetime[a] = now;
   }
+  if (KnobFalseShare.Value())
+    falseShareAccess(threadid, funcid, addr, size, TRUE, object);
+  if (donuma)
+    numaAccess(threadid, reg, addr, size, TRUE);
   U();
 }
 
@@ -472,6 +1675,7 @@ VOID RecordEntry(THREADID threadid, UINT32 funcid, ADDRINT sp, UINT32 countFirst
 {
   assert(funcid);
   safeThreadId(threadid);
+  STAT(threadid, STAT_ENTRY);
   UINT32 dfid = ++dfuncid[threadid];
   safeStackPtr(threadid);
   UINT32 mregion = callStack[threadid].empty() ? 0 : callStack[threadid].back().mregion;
@@ -481,16 +1685,28 @@ VOID RecordEntry(THREADID threadid, UINT32 funcid, ADDRINT sp, UINT32 countFirst
   callStack[threadid].back().returnIp = returnIp;
   callStack[threadid].back().mregion = mregion;
   callStack[threadid].back().dfuncid = dfid;
-  callStack[threadid].back().icount_start = icount[threadid] - countFirst;
+  callStack[threadid].back().icount_start = tcount[threadid].icount - countFirst;
   callStack[threadid].back().icounttot_start = icount_tot;
   callStack[threadid].back().output = state == S_MEASURE ? 0 : 1;
   setRegion(threadid);
 }
 
 
+/* 'X' <threadid> <icount> <collapsed> */
+inline void storeExit(THREADID threadid, UINT32 collapsed)
+{
+  BINSTORE_RECORD * r = &trec[threadid];
+  bs_put_char(r, 'X');
+  bs_put_u32(r, threadid);
+  bs_put_u64(r, tcount[threadid].icount);
+  bs_put_u32(r, collapsed);
+  bs_end_record(trace, r);
+}
+
 // Print a return record
 VOID RecordReturn(THREADID threadid, UINT32 funcid, ADDRINT sp)
 {
+  STAT(threadid, STAT_RETURN);
   if (sp && !callStack[threadid].empty() && sp < callStack[threadid].back().sp)
     return;
   checkFunc(threadid, funcid, sp);
@@ -498,7 +1714,7 @@ VOID RecordReturn(THREADID threadid, UINT32 funcid, ADDRINT sp)
     if (state == S_MEASURE) {
       L();
 
-      if (icount[threadid] - callStack[threadid].back().icount_start < KnobMinLen.Value()
+      if (tcount[threadid].icount - callStack[threadid].back().icount_start < KnobMinLen.Value()
         && callStack[threadid].size() > 1) {
         /* function too short, merge into parent */
         UINT64 parent = makeRegion(threadid, callStack[threadid][callStack[threadid].size() - 2]);
@@ -506,15 +1722,23 @@ VOID RecordReturn(THREADID threadid, UINT32 funcid, ADDRINT sp)
         for(std::map<UINT64, UINT64>::iterator it = comm[region[threadid]].begin(); it != comm[region[threadid]].end(); ++it) {
           comm[parent][it->first] += it->second;
         }
+        mergeLatency(region[threadid], parent);
+        mergeCache(region[threadid], parent);
+        if (ocomm.count(region[threadid])) {
+          for(ocommItemType::iterator it = ocomm[region[threadid]].begin(); it != ocomm[region[threadid]].end(); ++it)
+            ocomm[parent][it->first] += it->second;
+          ocomm.erase(region[threadid]);
+        }
+        rollupRegions();
 
         /* frame was opened ('E' emited), make sure we close it (emit 'X') */
         if (callStack[threadid].back().output)
-          binstore_store(trace, "cili", 'X', threadid, icount[threadid], 1);
+          storeExit(threadid, 1);
       } else {
 
         outputSelfAndParents(threadid);
         storeComm(region[threadid]);
-        binstore_store(trace, "cili", 'X', threadid, icount[threadid], 0);
+        storeExit(threadid, 0);
       }
       comm.erase(region[threadid]);
 
@@ -526,23 +1750,8 @@ VOID RecordReturn(THREADID threadid, UINT32 funcid, ADDRINT sp)
 }
 
 
-#if 0
-VOID Malloc_Before(ADDRINT size, THREADID threadid, ADDRINT returnIp)
-{
-  safeThreadId(threadid);
-  malloc_size[threadid] = size;
-  malloc_returnip[threadid] = threadid;
-}
-
-VOID Malloc_After(ADDRINT address, THREADID threadid)
-{
-  safeThreadId(threadid);
-  ADDRINT size = malloc_size[threadid];
-  ADDRINT returnIp = malloc_returnip[threadid];
-#else
 VOID Malloc(ADDRINT size, ADDRINT address, THREADID threadid, ADDRINT returnIp)
 {
-#endif
   L();
   if (lognextobject[threadid]) {
     // fprintf(stdout, "[PINCOMM] Got object #%u\n", lognextobject[threadid]); fflush(stdout);
@@ -561,81 +1770,404 @@ VOID Free(ADDRINT address, THREADID threadid, ADDRINT returnIp)
 {
   L();
   outputSelfAndParents(threadid);
-  binstore_store(trace, "cii", 'N', threadid, address);
+  bs_put_char(&trec[threadid], 'N');
+  bs_put_u32(&trec[threadid], threadid);
+  bs_put_u32(&trec[threadid], address);
+  bs_end_record(trace, &trec[threadid]);
 //printf("free: %x\n", address);
+  if (doobjects) {
+    objRangesType::iterator it = objranges.find(address);
+    if (it != objranges.end()) {
+      objectInvalidate(it->first, it->second.first);
+      objranges.erase(it);
+    }
+  }
   U();
 }
 
 
+enum allocKind { A_MALLOC, A_CALLOC, A_REALLOC, A_MEMALIGN, A_POSIX_MEMALIGN, A_MMAP, A_FREE, A_MUNMAP };
+
+static const struct { const char * name; allocKind kind; } allocRtns[] = {
+  { "malloc", A_MALLOC },
+  { "valloc", A_MALLOC },
+  { "calloc", A_CALLOC },
+  { "realloc", A_REALLOC },
+  { "memalign", A_MEMALIGN },
+  { "posix_memalign", A_POSIX_MEMALIGN },
+  { "aligned_alloc", A_MEMALIGN },
+  { "_Znwj", A_MALLOC },                      /* operator new(unsigned int) */
+  { "_Znwm", A_MALLOC },                      /* operator new(unsigned long) */
+  { "_Znaj", A_MALLOC },                      /* operator new[] */
+  { "_Znam", A_MALLOC },
+  { "_ZnwjRKSt9nothrow_t", A_MALLOC },
+  { "_ZnwmRKSt9nothrow_t", A_MALLOC },
+  { "_ZnajRKSt9nothrow_t", A_MALLOC },
+  { "_ZnamRKSt9nothrow_t", A_MALLOC },
+  { "_ZnwjSt11align_val_t", A_MALLOC },       /* C++17 aligned operator new */
+  { "_ZnwmSt11align_val_t", A_MALLOC },
+  { "_ZnajSt11align_val_t", A_MALLOC },
+  { "_ZnamSt11align_val_t", A_MALLOC },
+  { "_ZnwjSt11align_val_tRKSt9nothrow_t", A_MALLOC },
+  { "_ZnwmSt11align_val_tRKSt9nothrow_t", A_MALLOC },
+  { "_ZnajSt11align_val_tRKSt9nothrow_t", A_MALLOC },
+  { "_ZnamSt11align_val_tRKSt9nothrow_t", A_MALLOC },
+  { "mmap", A_MMAP },
+  { "mmap64", A_MMAP },
+  { "free", A_FREE },
+  { "cfree", A_FREE },
+  { "_ZdlPv", A_FREE },                       /* operator delete */
+  { "_ZdaPv", A_FREE },                       /* operator delete[] */
+  { "_ZdlPvRKSt9nothrow_t", A_FREE },
+  { "_ZdaPvRKSt9nothrow_t", A_FREE },
+  { "_ZdlPvj", A_FREE },                      /* C++14 sized operator delete */
+  { "_ZdlPvm", A_FREE },
+  { "_ZdaPvj", A_FREE },
+  { "_ZdaPvm", A_FREE },
+  { "_ZdlPvSt11align_val_t", A_FREE },        /* C++17 aligned operator delete */
+  { "_ZdaPvSt11align_val_t", A_FREE },
+  { "_ZdlPvjSt11align_val_t", A_FREE },
+  { "_ZdlPvmSt11align_val_t", A_FREE },
+  { "_ZdaPvjSt11align_val_t", A_FREE },
+  { "_ZdaPvmSt11align_val_t", A_FREE },
+  { "_ZdlPvSt11align_val_tRKSt9nothrow_t", A_FREE },
+  { "_ZdaPvSt11align_val_tRKSt9nothrow_t", A_FREE },
+  { "munmap", A_MUNMAP },
+};
 
+#define ALLOC_MAP_ANONYMOUS 0x20
+#define ALLOC_MAP_FAILED ((ADDRINT)-1)
 
 
-VOID * Jit_Malloc_IA32( CONTEXT * context, AFUNPTR orgFuncptr, size_t size, THREADID threadid)
+/* allocator entry: remember what is being allocated, the result is logged by AllocAfter() */
+VOID AllocBefore(THREADID threadid, UINT32 kind, ADDRINT sp, ADDRINT returnIp, ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, ADDRINT arg3)
 {
-    VOID * ret;
+  safeThreadId(threadid);
+  STAT(threadid, STAT_ALLOC);
+  allocPendingType & p = allocPending[threadid];
+  /* an outer allocator that was left without passing through AllocAfter() (longjmp, exception) */
+  if (p.depth && sp > p.sp)
+    p.depth = 0;
+  if (p.depth++)
+    return;
+  p.kind = kind;
+  p.sp = sp;
+  p.returnIp = returnIp;
+  p.address = 0;
+  switch(kind) {
+    case A_MALLOC:          p.size = arg0; break;
+    case A_CALLOC:          p.count = arg0; p.size = arg1; break;
+    case A_REALLOC:         p.address = arg0; p.size = arg1; break;
+    case A_MEMALIGN:        p.size = arg1; break;
+    case A_POSIX_MEMALIGN:  p.address = arg0; p.size = arg2; break;
+    /* only anonymous mappings are memory allocations, file mappings (such as the dynamic loader's) aren't */
+    case A_MMAP:            p.size = arg3 & ALLOC_MAP_ANONYMOUS ? arg1 : 0; break;
+    case A_FREE:
+      if (arg0)
+        Free(arg0, threadid, returnIp);
+      break;
+    case A_MUNMAP:
+      L();
+      if (mmapped.erase(arg0))
+        Free(arg0, threadid, returnIp);
+      U();
+      break;
+  }
+}
 
-    PIN_CallApplicationFunction( context, PIN_ThreadId(),
-                                 CALLINGSTD_DEFAULT, orgFuncptr,
-                                 PIN_PARG(void *), &ret,
-                                 PIN_PARG(size_t), size,
-                                 PIN_PARG_END() );
 
-//printf("malloc(%d) returns %p\n", size, ret);
-    Malloc(size, (ADDRINT)ret, threadid, 0);
-    return ret;
+VOID AllocAfter(THREADID threadid, ADDRINT ret)
+{
+  allocPendingType & p = allocPending[threadid];
+  if (p.depth == 0 || --p.depth)
+    return;
+  switch(p.kind) {
+    case A_MALLOC:
+    case A_MEMALIGN:
+      if (ret)
+        Malloc(p.size, ret, threadid, p.returnIp);
+      break;
+    case A_CALLOC:
+      /* count * size overflowing is an error, calloc() shouldn't have returned a block */
+      if (ret && (!p.size || p.count <= (ADDRINT)-1 / p.size))
+        Malloc(p.count * p.size, ret, threadid, p.returnIp);
+      break;
+    case A_REALLOC:
+      if (ret || !p.size) {
+        if (p.address)
+          Free(p.address, threadid, p.returnIp);
+        if (ret)
+          Malloc(p.size, ret, threadid, p.returnIp);
+      }
+      break;
+    case A_POSIX_MEMALIGN:
+      if (ret == 0 && PIN_SafeCopy(&ret, (VOID *)p.address, sizeof(ret)) == sizeof(ret) && ret)
+        Malloc(p.size, ret, threadid, p.returnIp);
+      break;
+    case A_MMAP:
+      if (p.size && ret != ALLOC_MAP_FAILED) {
+        L();
+        mmapped.insert(ret);
+        Malloc(p.size, ret, threadid, p.returnIp);
+        U();
+      }
+      break;
+  }
 }
 
-/* ===================================================================== */
 
-VOID Jit_Free_IA32( CONTEXT * context, AFUNPTR orgFuncptr, void * ptr, THREADID threadid)
+/* -symcache: cache file for <img>, <dir>/<name>.<path hash>.<mtime>.<size>.pcs, empty if <img> is not a file */
+string symCacheName(IMG img)
 {
-    PIN_CallApplicationFunction( context, PIN_ThreadId(),
-                                 CALLINGSTD_DEFAULT, orgFuncptr,
-                                 PIN_PARG(void),
-                                 PIN_PARG(void *), ptr,
-                                 PIN_PARG_END() );
-
-//printf("free(%p)\n", ptr);
-    Free((ADDRINT)ptr, threadid, 0);
+  string path = IMG_Name(img);
+  struct stat st;
+  if (stat(path.c_str(), &st))
+    return "";
+  UINT32 hash = 2166136261u;  /* FNV-1a */
+  for(const char * c = path.c_str(); *c; ++c)
+    hash = (hash ^ (UINT8)*c) * 16777619u;
+  char suffix[64];
+  snprintf(suffix, sizeof(suffix), ".%08x.%lx.%lx.pcs", hash, (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+  return KnobSymCache.Value() + "/" + path.substr(path.rfind('/') + 1) + suffix;
 }
 
-VOID ImageLoad(IMG img, VOID *v)
+/* -symcache: write the 'F' and 'A' records of all routines in <img> to <filename>, with addresses relative to
+   the start of the image: 'F' <offset> <name> <file> <line>, 'A' <return address offset> <routine offset> <file> <line>.
+   Written to a temporary file first so concurrent runs never see a partial table */
+BOOL symCacheWrite(IMG img, string filename)
 {
-    RTN mallocRtn = RTN_FindByName(img, "malloc");
-    if (RTN_Valid(mallocRtn))
-    {
-        PROTO proto_malloc = PROTO_Allocate( PIN_PARG(void *), CALLINGSTD_DEFAULT,
-                                             "malloc", PIN_PARG(size_t), PIN_PARG_END() );
+  char tmp[32];
+  snprintf(tmp, sizeof(tmp), ".%u.tmp", (unsigned)getpid());
+  BINSTORE * bs = binstore_open((filename + tmp).c_str(), "w");
+  if (!bs)
+    return FALSE;
+  ADDRINT base = IMG_LowAddress(img);
+  for(SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
+    for(RTN rtn = SEC_RtnHead(sec); RTN_Valid(rtn); rtn = RTN_Next(rtn)) {
+      INT32 line; string fileName;
+      PIN_GetSourceLocation(RTN_Address(rtn), NULL, &line, &fileName);
+      bs_put_char(&rec, 'F');
+      bs_put_u64(&rec, RTN_Address(rtn) - base);
+      bs_put_str(&rec, RTN_Name(rtn).c_str());
+      bs_put_str(&rec, fileName.c_str());
+      bs_put_u32(&rec, line);
+      bs_end_record(bs, &rec);
+      RTN_Open(rtn);
+      for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins))
+        if (INS_IsCall(ins)) {
+          PIN_GetSourceLocation(INS_Address(ins), NULL, &line, &fileName);
+          if (line) {
+            bs_put_char(&rec, 'A');
+            bs_put_u64(&rec, INS_NextAddress(ins) - base);
+            bs_put_u64(&rec, RTN_Address(rtn) - base);
+            bs_put_str(&rec, fileName.c_str());
+            bs_put_u32(&rec, line);
+            bs_end_record(bs, &rec);
+          }
+        }
+      RTN_Close(rtn);
+    }
+  binstore_close(bs);
+  return rename((filename + tmp).c_str(), filename.c_str()) == 0;
+}
 
 
-        RTN_ReplaceSignature(
-            mallocRtn, AFUNPTR( Jit_Malloc_IA32 ),
-            IARG_PROTOTYPE, proto_malloc,
-            IARG_CONTEXT,
-            IARG_ORIG_FUNCPTR,
-            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-            IARG_THREAD_ID,
-            IARG_END);
-        //TraceFile << "Replaced malloc() in:"  << IMG_Name(img) << endl;
+enum syncKind { SYNC_LOCK, SYNC_TRYLOCK, SYNC_UNLOCK, SYNC_COND_WAIT, SYNC_COND_SIGNAL, SYNC_BARRIER, SYNC_FUTEX };
+
+static const struct { const char * name; syncKind kind; } syncRtns[] = {
+  { "pthread_mutex_lock", SYNC_LOCK },
+  { "pthread_mutex_trylock", SYNC_TRYLOCK },
+  { "pthread_mutex_timedlock", SYNC_TRYLOCK },
+  { "pthread_mutex_unlock", SYNC_UNLOCK },
+  { "pthread_spin_lock", SYNC_LOCK },
+  { "pthread_spin_trylock", SYNC_TRYLOCK },
+  { "pthread_spin_unlock", SYNC_UNLOCK },
+  { "pthread_rwlock_rdlock", SYNC_LOCK },
+  { "pthread_rwlock_wrlock", SYNC_LOCK },
+  { "pthread_rwlock_tryrdlock", SYNC_TRYLOCK },
+  { "pthread_rwlock_trywrlock", SYNC_TRYLOCK },
+  { "pthread_rwlock_timedrdlock", SYNC_TRYLOCK },
+  { "pthread_rwlock_timedwrlock", SYNC_TRYLOCK },
+  { "pthread_rwlock_unlock", SYNC_UNLOCK },
+  { "pthread_cond_wait", SYNC_COND_WAIT },
+  { "pthread_cond_timedwait", SYNC_COND_WAIT },
+  { "pthread_cond_signal", SYNC_COND_SIGNAL },
+  { "pthread_cond_broadcast", SYNC_COND_SIGNAL },
+  { "pthread_barrier_wait", SYNC_BARRIER },
+};
+
+#define SYNC_FUTEX_CMD(op) ((op) & 0x7f)    /* without FUTEX_PRIVATE_FLAG and FUTEX_CLOCK_REALTIME */
+#define SYNC_FUTEX_WAIT 0
+#define SYNC_FUTEX_WAKE 1
+#define SYNC_FUTEX_WAIT_BITSET 9
+#define SYNC_FUTEX_WAKE_BITSET 10
+
+
+/* -sync: <threadid> acquired (or passed, or was woken through) <object> */
+VOID syncAcquire(THREADID threadid, ADDRINT object, UINT32 kind)
+{
+  syncType & so = syncs[object];
+  so.kind = kind;
+  if (state == S_MEASURE) {
+    ++so.acquires;
+    if (so.last && so.last != threadid + 1)
+      ++so.handoffs;
+  }
+  so.last = threadid + 1;
+  if (kind == SO_LOCK)
+    syncHeld[threadid].push_back(object);
+  else
+    syncEpisode[threadid] = object;
+}
+
+/* -sync: <threadid> released <object> (or signalled it, or woke its waiters) */
+VOID syncRelease(THREADID threadid, ADDRINT object, UINT32 kind)
+{
+  syncType & so = syncs[object];
+  so.kind = kind;
+  so.last = threadid + 1;
+  std::vector<ADDRINT> & held = syncHeld[threadid];
+  for(size_t i = held.size(); i > 0; --i)
+    if (held[i - 1] == object) {
+      held.erase(held.begin() + i - 1);
+      break;
     }
+}
+
+
+/* sync routine entry: remember the object, the acquire or release is done by SyncAfter() */
+VOID SyncBefore(THREADID threadid, UINT32 kind, ADDRINT sp, ADDRINT arg0, ADDRINT arg1, ADDRINT arg2)
+{
+  safeThreadId(threadid);
+  syncPendingType & p = syncPending[threadid];
+  /* an outer sync routine that was left without passing through SyncAfter() (longjmp, cancellation) */
+  if (p.depth && sp > p.sp)
+    p.depth = 0;
+  if (p.depth++)
+    return;
+  p.kind = kind;
+  p.sp = sp;
+  p.object = arg0;
+  p.arg1 = arg1;
+  L();
+  if (kind == SYNC_FUTEX)
+    futexWords.insert(p.object);
+  switch(kind) {
+    case SYNC_UNLOCK:       syncRelease(threadid, p.object, SO_LOCK); break;
+    /* the mutex is released while waiting */
+    case SYNC_COND_WAIT:    syncRelease(threadid, p.arg1, SO_LOCK); break;
+    case SYNC_COND_SIGNAL:  syncRelease(threadid, p.object, SO_COND); break;
+    case SYNC_FUTEX:
+      if (SYNC_FUTEX_CMD(p.arg1) == SYNC_FUTEX_WAKE || SYNC_FUTEX_CMD(p.arg1) == SYNC_FUTEX_WAKE_BITSET)
+        syncRelease(threadid, p.object, SO_FUTEX);
+      break;
+  }
+  U();
+}
+
+
+VOID SyncAfter(THREADID threadid, ADDRINT ret)
+{
+  syncPendingType & p = syncPending[threadid];
+  if (p.depth == 0 || --p.depth)
+    return;
+  L();
+  switch(p.kind) {
+    case SYNC_LOCK:         syncAcquire(threadid, p.object, SO_LOCK); break;
+    case SYNC_TRYLOCK:
+      if (ret == 0)
+        syncAcquire(threadid, p.object, SO_LOCK);
+      break;
+    case SYNC_COND_WAIT:
+      syncAcquire(threadid, p.object, SO_COND);
+      syncAcquire(threadid, p.arg1, SO_LOCK);
+      break;
+    case SYNC_BARRIER:      syncAcquire(threadid, p.object, SO_BARRIER); break;
+    case SYNC_FUTEX:
+      if (SYNC_FUTEX_CMD(p.arg1) == SYNC_FUTEX_WAIT || SYNC_FUTEX_CMD(p.arg1) == SYNC_FUTEX_WAIT_BITSET)
+        syncAcquire(threadid, p.object, SO_FUTEX);
+      break;
+  }
+  U();
+}
 
-    RTN freeRtn = RTN_FindByName(img, "free");
-    if (RTN_Valid(freeRtn))
-    {
-        PROTO proto_free = PROTO_Allocate( PIN_PARG(void), CALLINGSTD_DEFAULT,
-                                           "free", PIN_PARG(void *), PIN_PARG_END() );
 
+/* -sync: futex system calls, however they are made (glibc's syscall(), or inline as libgomp and most custom
+   locks do). Those made by the pthread routines above are part of them */
+VOID SyscallEntry(THREADID threadid, CONTEXT * ctxt, SYSCALL_STANDARD std, VOID * v)
+{
+  if (PIN_GetSyscallNumber(ctxt, std) != SYS_futex || syncPending[threadid].depth)
+    return;
+  syncInFutex[threadid] = TRUE;
+  SyncBefore(threadid, SYNC_FUTEX, PIN_GetContextReg(ctxt, REG_STACK_PTR),
+    PIN_GetSyscallArgument(ctxt, std, 0), PIN_GetSyscallArgument(ctxt, std, 1), 0);
+}
 
-        RTN_ReplaceSignature(
-            freeRtn, AFUNPTR( Jit_Free_IA32 ),
-            IARG_PROTOTYPE, proto_free,
-            IARG_CONTEXT,
-            IARG_ORIG_FUNCPTR,
-            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-            IARG_THREAD_ID,
-            IARG_END);
-        //TraceFile << "Replaced free() in:"  << IMG_Name(img) << endl;
+VOID SyscallExit(THREADID threadid, CONTEXT * ctxt, SYSCALL_STANDARD std, VOID * v)
+{
+  if (!syncInFutex[threadid])
+    return;
+  syncInFutex[threadid] = FALSE;
+  SyncAfter(threadid, PIN_GetSyscallReturn(ctxt, std));
+}
+
+
+VOID ImageLoad(IMG img, VOID *v)
+{
+  /* -symcache: refer to the cached function and call site table: 'Y' <cache file> <image> <load address> */
+  if (KnobSymCache.Value() != "") {
+    string cache = symCacheName(img);
+    if (cache != "" && (access(cache.c_str(), R_OK) == 0 || symCacheWrite(img, cache))) {
+      bs_put_char(&rec, 'Y');
+      bs_put_str(&rec, cache.c_str());
+      bs_put_str(&rec, IMG_Name(img).c_str());
+      bs_put_u64(&rec, IMG_LowAddress(img));
+      bs_end_record(trace, &rec);
+      cachedImages.insert(IMG_Id(img));
     }
+  }
+
+  /* RTN_FindByName() also finds a routine under an alias (malloc is __libc_malloc, mmap is __mmap),
+     RoutineHooks() then goes by address. The first name found for an address wins */
+  for(unsigned int i = 0; i < sizeof(allocRtns) / sizeof(allocRtns[0]); ++i) {
+    RTN rtn = RTN_FindByName(img, allocRtns[i].name);
+    if (RTN_Valid(rtn))
+      hookRtns.insert(std::make_pair(RTN_Address(rtn), hookRtnType(FALSE, i)));
+  }
+  for(unsigned int i = 0; dosync && i < sizeof(syncRtns) / sizeof(syncRtns[0]); ++i) {
+    RTN rtn = RTN_FindByName(img, syncRtns[i].name);
+    if (RTN_Valid(rtn))
+      hookRtns.insert(std::make_pair(RTN_Address(rtn), hookRtnType(TRUE, i)));
+  }
+}
+
+VOID ImageUnload(IMG img, VOID *v)
+{
+  /* another image may be loaded at these addresses later */
+  hookRtns.erase(hookRtns.lower_bound(IMG_LowAddress(img)), hookRtns.upper_bound(IMG_HighAddress(img)));
+}
+
+
+/* allocator and -sync routines, <rtn> must be open. Done from Routine() rather than ImageLoad(): after
+   PIN_RemoveInstrumentation() (-skip, -windows) only routines are instrumented again, images aren't */
+VOID RoutineHooks(RTN rtn)
+{
+  std::map<ADDRINT, hookRtnType>::iterator it = hookRtns.find(RTN_Address(rtn));
+  if (it == hookRtns.end())
+    return;
+  unsigned int i = it->second.second;
+  if (!it->second.first) {
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)AllocBefore, IARG_THREAD_ID, IARG_UINT32, allocRtns[i].kind,
+      IARG_REG_VALUE, REG_STACK_PTR, IARG_RETURN_IP,
+      IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+      IARG_FUNCARG_ENTRYPOINT_VALUE, 2, IARG_FUNCARG_ENTRYPOINT_VALUE, 3, IARG_END);
+    RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)AllocAfter, IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+  } else {
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)SyncBefore, IARG_THREAD_ID, IARG_UINT32, syncRtns[i].kind,
+      IARG_REG_VALUE, REG_STACK_PTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+      IARG_FUNCARG_ENTRYPOINT_VALUE, 2, IARG_END);
+    RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)SyncAfter, IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+  }
 }
 
 
@@ -657,12 +2189,23 @@ VOID Trace(TRACE trace, VOID *v)
 VOID Routine(RTN rtn, VOID *v)
 {
   UINT32 funcid = RTN_Address(rtn);
-
-  INT32 line; string fileName;
-  PIN_GetSourceLocation(RTN_Address(rtn), NULL, &line, &fileName);
-  binstore_store(trace, "cisssi", 'F', funcid, IMG_Name(SEC_Img(RTN_Sec(rtn))).c_str(), RTN_Name(rtn).c_str(), fileName.c_str(), line);
+  /* routines are instrumented again after PIN_RemoveInstrumentation(), their records are only written once */
+  BOOL cached = cachedImages.count(IMG_Id(SEC_Img(RTN_Sec(rtn)))) || !routinesSeen.insert(funcid).second;
+
+  if (!cached) {
+    INT32 line; string fileName;
+    PIN_GetSourceLocation(RTN_Address(rtn), NULL, &line, &fileName);
+    bs_put_char(&rec, 'F');
+    bs_put_u32(&rec, funcid);
+    bs_put_str(&rec, IMG_Name(SEC_Img(RTN_Sec(rtn))).c_str());
+    bs_put_str(&rec, RTN_Name(rtn).c_str());
+    bs_put_str(&rec, fileName.c_str());
+    bs_put_u32(&rec, line);
+    bs_end_record(trace, &rec);
+  }
 
   RTN_Open(rtn);
+  RoutineHooks(rtn);
 
   /*if (RTN_Name(rtn) == "malloc")
     RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)Malloc, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCRET_EXITPOINT_VALUE, IARG_THREAD_ID, IARG_RETURN_IP, IARG_END);
@@ -675,11 +2218,23 @@ VOID Routine(RTN rtn, VOID *v)
     RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)Free, IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_THREAD_ID, IARG_RETURN_IP, IARG_END);
     */
 
-  RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)RecordEntry, IARG_THREAD_ID, IARG_UINT32, funcid, IARG_REG_VALUE, REG_STACK_PTR, IARG_UINT32, 0/*BBL_NumIns(RTN_BblHead(rtn))*/, IARG_RETURN_IP, IARG_END);
+  if (!fastforward)
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)RecordEntry, IARG_THREAD_ID, IARG_UINT32, funcid, IARG_REG_VALUE, REG_STACK_PTR, IARG_UINT32, 0/*BBL_NumIns(RTN_BblHead(rtn))*/, IARG_RETURN_IP, IARG_END);
   for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins))
   {
-    if (!KnobIgnoreComm) {
-      if (INS_IsMemoryRead(ins)) {
+    if (INS_Disassemble(ins) == "xchg bx, bx") {
+      /* SIMICS Magic Instruction */
+      INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)Magic, IARG_THREAD_ID, IARG_REG_VALUE, REG_EAX, IARG_REG_VALUE, REG_ECX, IARG_REG_VALUE, REG_EDX, IARG_END);
+    }
+    /* fast-forwarding (-skip, -windows): Trace() counts the instructions, only the markers are needed */
+    if (fastforward && cached)
+      continue;
+    if (!KnobIgnoreComm && !fastforward) {
+      if (INS_IsMemoryRead(ins) && KnobHotLoads.Value()) {
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordMemReadPC, IARG_THREAD_ID, IARG_UINT32, funcid, IARG_REG_VALUE, REG_STACK_PTR, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_INST_PTR, IARG_END);
+        if (INS_HasMemoryRead2(ins))
+          INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordMemReadPC, IARG_THREAD_ID, IARG_UINT32, funcid, IARG_REG_VALUE, REG_STACK_PTR, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_INST_PTR, IARG_END);
+      } else if (INS_IsMemoryRead(ins)) {
         INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordMemRead, IARG_THREAD_ID, IARG_UINT32, funcid, IARG_REG_VALUE, REG_STACK_PTR, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
         if (INS_HasMemoryRead2(ins))
           INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordMemRead, IARG_THREAD_ID, IARG_UINT32, funcid, IARG_REG_VALUE, REG_STACK_PTR, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_END);
@@ -687,17 +2242,19 @@ VOID Routine(RTN rtn, VOID *v)
       if (INS_IsMemoryWrite(ins))
         INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordMemWrite, IARG_THREAD_ID, IARG_UINT32, funcid, IARG_REG_VALUE, REG_STACK_PTR, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
     }
-    if (INS_IsRet(ins))
+    if (INS_IsRet(ins) && !fastforward)
       INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordReturn, IARG_THREAD_ID, IARG_UINT32, funcid, IARG_REG_VALUE, REG_STACK_PTR, IARG_END);
-    if (INS_Disassemble(ins) == "xchg bx, bx") {
-      /* SIMICS Magic Instruction */
-      INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)Magic, IARG_THREAD_ID, IARG_REG_VALUE, REG_EAX, IARG_REG_VALUE, REG_ECX, IARG_REG_VALUE, REG_EDX, IARG_END);
-    }
-    if (INS_IsCall(ins)) {
+    if (INS_IsCall(ins) && !cached) {
       INT32 line; string fileName;
       PIN_GetSourceLocation(INS_Address(ins), NULL, &line, &fileName);
-      if (line)
-        binstore_store(trace, "ciisi", 'A', INS_NextAddress(ins), RTN_Address(INS_Rtn(ins)), fileName.c_str(), line);
+      if (line) {
+        bs_put_char(&rec, 'A');
+        bs_put_u32(&rec, INS_NextAddress(ins));
+        bs_put_u32(&rec, RTN_Address(INS_Rtn(ins)));
+        bs_put_str(&rec, fileName.c_str());
+        bs_put_u32(&rec, line);
+        bs_end_record(trace, &rec);
+      }
     }
   }
 
@@ -709,13 +2266,61 @@ VOID TheEnd()
 {
   if (state == S_MEASURE)
     StateMeasureEnd(TRUE);
+  if (dostats)
+    storeStats(TRUE);
   binstore_close(trace);
+  if (shmring) {
+    /* pincommring drains the rings and writes the CSV */
+    shmring->hdr->done = 1;
+    shmring_close(shmring);
+    shmring = NULL;
+  }
   if (KnobRegionOnly.Value()) {
-    FILE *fp = fopen(KnobCsvOutputFile.Value().c_str(), "w");
-    for(std::map<UINT64, std::map<UINT64, UINT64> >::iterator it = only_region.begin(); it != only_region.end(); ++it)
-      for(std::map<UINT64, UINT64>::iterator jt = it->second.begin(); jt != it->second.end(); ++jt)
-        fprintf(fp, "%"PRIu64",%"PRIu64",%"PRIu64"\n", it->first, jt->first, jt->second);
-    fclose(fp);
+    /* merge the per-thread matrices */
+    std::map<std::pair<UINT32, UINT32>, UINT64> total;
+    for(int tid = 0; tid < MAX_THREADS; ++tid) {
+      regionOnlyType & ro = only_region[tid];
+      if (ro.dense)
+        for(UINT32 src = 0; src < REGIONONLY_DENSE; ++src)
+          for(UINT32 dst = 0; dst < REGIONONLY_DENSE; ++dst)
+            if (ro.dense[src][dst])
+              total[std::make_pair(src, dst)] += ro.dense[src][dst];
+      for(UINT64 i = 0; i < ro.size; ++i)
+        if (ro.keys[i])
+          total[std::make_pair((UINT32)(ro.keys[i] >> 32), (UINT32)ro.keys[i])] += ro.values[i];
+    }
+    if (KnobCsrOutputFile.Value() != "") {
+      /* nodes are the regions that occur in the matrix, named by their number */
+      std::map<UINT32, UINT32> index;
+      std::vector<std::string> names;
+      std::vector<const char *> cnames;
+      std::vector<CSR_EDGE> edges;
+      for(std::map<std::pair<UINT32, UINT32>, UINT64>::iterator it = total.begin(); it != total.end(); ++it) {
+        index[it->first.first] = 0;
+        index[it->first.second] = 0;
+      }
+      for(std::map<UINT32, UINT32>::iterator it = index.begin(); it != index.end(); ++it) {
+        char name[16];
+        sprintf(name, "%u", it->first);
+        it->second = names.size();
+        names.push_back(name);
+      }
+      for(size_t i = 0; i < names.size(); ++i)
+        cnames.push_back(names[i].c_str());
+      for(std::map<std::pair<UINT32, UINT32>, UINT64>::iterator it = total.begin(); it != total.end(); ++it) {
+        CSR_EDGE e = { index[it->first.second], index[it->first.first], it->second };
+        edges.push_back(e);
+      }
+      const std::string & filename = KnobCsrOutputFile.Value();
+      bool compress = filename.size() > 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0;
+      if (csr_write(filename.c_str(), compress, names.size(), cnames.empty() ? NULL : &cnames[0], edges.size(), edges.empty() ? NULL : &edges[0]))
+        fprintf(stderr, "[PINCOMM] Cannot write %s\n", filename.c_str());
+    } else {
+      FILE *fp = fopen(KnobCsvOutputFile.Value().c_str(), "w");
+      for(std::map<std::pair<UINT32, UINT32>, UINT64>::iterator it = total.begin(); it != total.end(); ++it)
+        fprintf(fp, "%u,%u,%"PRIu64"\n", it->first.first, it->first.second, it->second);
+      fclose(fp);
+    }
   }
 }
 
@@ -746,17 +2351,97 @@ int main(int argc, char *argv[])
   }
 
   memgran_bits = ln2(KnobMemGran.Value());
-
+  if (KnobRegionTime.Value() && KnobRegionTime.Value() / 16 < icount_flush)
+    icount_flush = KnobRegionTime.Value() / 16 + 1;
+  if (KnobInterval.Value() && KnobInterval.Value() / 16 < icount_flush)
+    icount_flush = KnobInterval.Value() / 16 + 1;
+  if (KnobLatency.Value() && LATENCY_FLUSH < icount_flush)
+    icount_flush = LATENCY_FLUSH;   /* keep the skew between threads' notion of time small */
+  dostats = KnobStats.Value() != 0;
+  if (KnobCache.Value()) {
+    cache_line_bits = ln2(KnobCacheLine.Value());
+    cache_assoc = KnobCacheAssoc.Value();
+    cache_sets = ((UINT64)KnobCache.Value() << 10) >> cache_line_bits;
+    cache_sets = cache_assoc ? cache_sets / cache_assoc : 0;
+    if (!cache_sets || (cache_sets & (cache_sets - 1)) || (1U << cache_line_bits) != KnobCacheLine.Value()) {
+      fprintf(stderr, "[PINCOMM] -cache / -cacheassoc / -cacheline must give a power of two number of sets and line size\n");
+      exit(-1);
+    }
+    docache = !KnobRegionOnly.Value() && KnobShmRing.Value() == "";
+    if (!docache)
+      fprintf(stderr, "[PINCOMM] -cache is ignored with -regiononly and -shmring\n");
+  }
+  if (KnobNuma.Value()) {
+    numa_page_bits = ln2(KnobNuma.Value());
+    if ((1U << numa_page_bits) != KnobNuma.Value()) {
+      fprintf(stderr, "[PINCOMM] -numa must be a power of two\n");
+      exit(-1);
+    }
+    donuma = !KnobRegionOnly.Value() && KnobShmRing.Value() == "";
+    if (!donuma)
+      fprintf(stderr, "[PINCOMM] -numa is ignored with -regiononly and -shmring\n");
+  }
+  if (KnobWindows.Value() != "") {
+    const char * w = KnobWindows.Value().c_str();
+    while(*w) {
+      char * end;
+      UINT64 start = strtoull(w, &end, 0), length = 0;
+      if (*end == ':')
+        length = strtoull(end + 1, &end, 0);
+      if (!length || (*end && *end != ',') || (!windows.empty() && start < windows.back().second)) {
+        fprintf(stderr, "[PINCOMM] -windows must be a list of <start>:<length>, in order and not overlapping\n");
+        exit(-1);
+      }
+      windows.push_back(std::make_pair(start, start + length));
+      w = *end ? end + 1 : end;
+    }
+  } else if (KnobSkip.Value() || KnobLength.Value())
+    windows.push_back(std::make_pair(KnobSkip.Value(), KnobLength.Value() ? KnobSkip.Value() + KnobLength.Value() : ~(UINT64)0));
+  if (!windows.empty() && (KnobUseMagic || KnobZone.Value())) {
+    fprintf(stderr, "[PINCOMM] -skip, -length and -windows can't be combined with -magic or -zone\n");
+    exit(-1);
+  }
+  fastforward = !windows.empty() && windows[0].first > 0;
+  dosync = KnobSync.Value() && !KnobRegionOnly.Value() && KnobShmRing.Value() == "";
+  if (KnobSync.Value() && !dosync)
+    fprintf(stderr, "[PINCOMM] -sync is ignored with -regiononly and -shmring\n");
+  /* these are only kept on the full memRead() path */
+  if (KnobRegionOnly.Value() || KnobShmRing.Value() != "") {
+    if (KnobInterval.Value())
+      fprintf(stderr, "[PINCOMM] -interval is ignored with -regiononly and -shmring\n");
+    if (KnobLatency.Value())
+      fprintf(stderr, "[PINCOMM] -latency is ignored with -regiononly and -shmring\n");
+    if (KnobFalseShare.Value())
+      fprintf(stderr, "[PINCOMM] -falseshare is ignored with -regiononly and -shmring\n");
+    if (KnobHotLoads.Value())
+      fprintf(stderr, "[PINCOMM] -hotloads is ignored with -regiononly and -shmring\n");
+  }
+  doobjects = KnobObjects.Value() || KnobFalseShare.Value() || KnobNuma.Value();
+  stats_next = KnobStats.Value();
+  if (KnobShmRing.Value() != "") {
+    shmring = shmring_open(KnobShmRing.Value().c_str());
+    if (!shmring) {
+      fprintf(stderr, "[PINCOMM] Cannot open shared memory rings %s, start pincommring first!\n", KnobShmRing.Value().c_str());
+      exit(-1);
+    }
+    shmring->hdr->memgran_bits = memgran_bits;
+    shmring->hdr->attached = 1;
+  }
 
   IMG_AddInstrumentFunction(ImageLoad, 0);
+  IMG_AddUnloadFunction(ImageUnload, 0);
 
   RTN_AddInstrumentFunction(Routine, 0);
   TRACE_AddInstrumentFunction(Trace, 0);
+  if (dosync) {
+    PIN_AddSyscallEntryFunction(SyscallEntry, 0);
+    PIN_AddSyscallExitFunction(SyscallExit, 0);
+  }
   PIN_AddFiniFunction(Fini, 0);
   PIN_AddDetachFunction(Detach, 0);
 
   state = S_INIT;
-  if (!KnobUseMagic && !KnobZone.Value())
+  if (!KnobUseMagic && !KnobZone.Value() && (windows.empty() || windows[0].first == 0))
     StateMeasureStart("program start");
 
   // Never returns
@@ -0,0 +1,155 @@
+/* $Id$ */
+
+/* pincommring: out-of-process analysis for pincomm -shmring.
+   Creates the shared memory rings, replays the accesses the pintool pushes into them in global order,
+   and writes the region to region communication matrix in the same CSV format as pincomm -regiononly. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <map>
+#include <vector>
+#include <queue>
+#include "shmring.h"
+
+
+static void usage()
+{
+  fprintf(stderr,
+    "Usage: pincommring [-r <rings>] [-n <nrings>] [-e <entries>] [-o <csv>]\n"
+    "  -r  shared memory file to create, pass the same name to pincomm -shmring (default: /dev/shm/pincommring)\n"
+    "  -n  number of rings, one per application thread (default: 256)\n"
+    "  -e  events per ring, rounded up to a power of two (default: 16384)\n"
+    "  -o  output file name for CSV output (default: pincommtrace.csv)\n");
+  exit(-1);
+}
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* shadow memory: region that last wrote each granule */
+static std::map<uint64_t, uint64_t> lastwritten;
+static std::map<std::pair<uint32_t, uint32_t>, uint64_t> matrix;
+static int memgran_bits;
+
+static void process(const SHMRING_EVENT * e)
+{
+  uint64_t first = e->addr >> memgran_bits, last = (e->addr + e->size - 1) >> memgran_bits;
+  if (e->type == SHMRING_WRITE) {
+    for(uint64_t a = first; a <= last; ++a)
+      lastwritten[a] = e->region;
+  } else {
+    uint32_t dst = (e->region >> 10) & 0x3fffff;
+    for(uint64_t a = first; a <= last; ++a) {
+      uint64_t s = 1 << memgran_bits;
+      if (a == first)
+        s -= e->addr - (a << memgran_bits);
+      if (a == last)
+        s -= ((a + 1) << memgran_bits) - (e->addr + e->size);
+      std::map<uint64_t, uint64_t>::iterator it = lastwritten.find(a);
+      matrix[std::make_pair(it == lastwritten.end() ? 0 : (uint32_t)((it->second >> 10) & 0x3fffff), dst)] += s;
+    }
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char * filename = "/dev/shm/pincommring", * csv = "pincommtrace.csv";
+  uint32_t nrings = 256;
+  uint64_t entries = 16384;
+  int c;
+  while((c = getopt(argc, argv, "r:n:e:o:h")) != -1)
+    switch(c) {
+      case 'r': filename = optarg; break;
+      case 'n': nrings = atoi(optarg); break;
+      case 'e': entries = strtoull(optarg, NULL, 0); break;
+      case 'o': csv = optarg; break;
+      default: usage();
+    }
+  if (optind != argc || !nrings || !entries)
+    usage();
+  while(entries & (entries - 1))
+    entries += entries & -entries;
+
+  SHMRING * sr = shmring_create(filename, nrings, entries);
+  if (!sr) {
+    fprintf(stderr, "[PINCOMMRING] Cannot create %s\n", filename);
+    exit(-1);
+  }
+  fprintf(stderr, "[PINCOMMRING] Waiting for pincomm -shmring %s\n", filename);
+  while(!sr->hdr->attached)
+    usleep(10000);
+  memgran_bits = sr->hdr->memgran_bits;
+  double start = now();
+
+  /* merge the rings in time stamp order: the heap holds the oldest event of each non-empty ring.
+     An event is only replayed once it is older than the watermark, at which point no ring can
+     still publish an event stamped before it */
+  typedef std::pair<uint64_t, uint32_t> headType;
+  std::priority_queue<headType, std::vector<headType>, std::greater<headType> > heads;
+  std::vector<bool> queued(nrings, false);
+  uint64_t events = 0, idle = 0;
+  while(true) {
+    /* check (done) before scanning, so no event pushed before the producer finished can be missed */
+    bool done = sr->hdr->done;
+    /* a thread killed while pushing leaves (pending) set, which no longer matters once the producer is done */
+    uint64_t watermark = done ? UINT64_MAX : shmring_watermark(sr);
+    for(uint32_t ring = 0; ring < nrings; ++ring)
+      if (!queued[ring]) {
+        SHMRING_EVENT * e = shmring_peek(sr, ring);
+        if (e) {
+          heads.push(headType(e->clock, ring));
+          queued[ring] = true;
+        }
+      }
+    bool found = false;
+    while(!heads.empty() && heads.top().first < watermark) {
+      uint32_t ring = heads.top().second;
+      heads.pop();
+      SHMRING_EVENT * e = shmring_peek(sr, ring);
+      process(e);
+      shmring_pop(sr, ring);
+      ++events;
+      found = true;
+      if ((e = shmring_peek(sr, ring)))
+        heads.push(headType(e->clock, ring));
+      else
+        queued[ring] = false;
+    }
+    if (found) {
+      idle = 0;
+      continue;
+    }
+    if (done && heads.empty())
+      break;
+    if (++idle > 1000)
+      usleep(100);
+    else
+      sched_yield();
+  }
+
+  double elapsed = now() - start;
+  fprintf(stderr, "[PINCOMMRING] %" PRIu64 " events in %.2f s (%.0f events/s), %lu granules of shadow memory\n",
+    events, elapsed, elapsed ? events / elapsed : 0, (unsigned long)lastwritten.size());
+  shmring_close(sr);
+  unlink(filename);
+
+  FILE *fp = fopen(csv, "w");
+  if (!fp) {
+    fprintf(stderr, "[PINCOMMRING] Cannot open %s\n", csv);
+    exit(-1);
+  }
+  for(std::map<std::pair<uint32_t, uint32_t>, uint64_t>::iterator it = matrix.begin(); it != matrix.end(); ++it)
+    fprintf(fp, "%u,%u,%" PRIu64 "\n", it->first.first, it->first.second, it->second);
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,424 @@
+#!/usr/bin/python
+# $Id$
+
+# Recommend a placement of threads (or (thread, region) nodes) on CPUs that minimizes communication
+# across sockets, caches and cores, given the communication matrix written by pinprocess.py and the
+# machine topology. The topology is partitioned top-down, at each level the communication graph
+# is split over the child domains with a multilevel partitioner (heavy-edge matching, greedy growing,
+# move/swap refinement).
+
+import sys, re, csv, getopt, random, subprocess, heapq, array, struct, binstore
+
+LEVELS = ('Drawer', 'Book', 'Socket', 'Node', 'L3', 'L2', 'Core')   # coarse to fine, as in lscpu -p
+COARSEN_TO = 16     # stop coarsening at <COARSEN_TO> vertices per part
+PASSES = 8          # maximum number of refinement passes per level
+SWAP_CANDIDATES = 8 # vertices of a full part considered for a swap
+
+
+filein = "-"
+fileout = "-"
+topology = None
+bythread = False
+bind = 'CPU'
+imbalance = 0.03
+seed = 1
+
+
+def usage():
+  print """\
+-i --input      communication matrix as written by pinprocess.py (from, to, bytes), default is stdin;
+                files ending in .csr or .csr.gz are read as binary CSR (pinprocess.py --csrout, pincomm -csrout)
+-o --output     output filename for the mapping, default is stdout
+-t --topology   lscpu -p style file, or <sockets>x<cores>x<threads>, default is to run lscpu -p
+--threads       map threads: merge all nodes of a thread (names as written by --groupby tr, ts or tf)
+--bind          bind each node to all CPUs of its domain at this level (Socket, L3, Core, ...), default is CPU
+--imbalance     allowed load imbalance when there are more nodes than CPUs, default is 0.03
+--seed          random seed, default is 1
+"""
+
+
+class Graph:
+
+  def __init__(self):
+    self.vwgt = []                    # vertex weights
+    self.adj = []                     # per vertex: { neighbour: edge weight }
+
+  def addVertex(self, weight = 1):
+    self.vwgt.append(weight)
+    self.adj.append({})
+    return len(self.vwgt) - 1
+
+  def addEdge(self, u, v, weight):
+    if u != v and weight:
+      self.adj[u][v] = self.adj[u].get(v, 0) + weight
+      self.adj[v][u] = self.adj[v].get(u, 0) + weight
+
+  def subgraph(self, vertices):
+    index = dict([ (v, i) for i, v in enumerate(vertices) ])
+    sub = Graph()
+    for v in vertices:
+      sub.vwgt.append(self.vwgt[v])
+      sub.adj.append(dict([ (index[u], w) for u, w in self.adj[v].iteritems() if u in index ]))
+    return sub
+
+
+def coarsen(g, maxvw, rnd):
+  """Heavy-edge matching: returns the coarse graph and the coarse vertex of each vertex"""
+  n = len(g.vwgt)
+  cmap = [ -1 ] * n
+  coarse = Graph()
+  order = range(n)
+  rnd.shuffle(order)
+  for v in order:
+    if cmap[v] >= 0: continue
+    best, bestw = None, 0
+    for u, w in g.adj[v].iteritems():
+      if cmap[u] < 0 and w > bestw and g.vwgt[u] + g.vwgt[v] <= maxvw:
+        best, bestw = u, w
+    c = coarse.addVertex(g.vwgt[v] + (best is not None and g.vwgt[best] or 0))
+    cmap[v] = c
+    if best is not None:
+      cmap[best] = c
+  for v in xrange(n):
+    cv = cmap[v]
+    for u, w in g.adj[v].iteritems():
+      cu = cmap[u]
+      if cu != cv:
+        coarse.adj[cv][cu] = coarse.adj[cv].get(cu, 0) + w
+  return coarse, cmap
+
+
+def initial(g, caps):
+  """Greedy graph growing: take vertices in order of connection to those already placed,
+     put each one in the part it is most connected to that still has room"""
+  n, k = len(g.vwgt), len(caps)
+  part = [ -1 ] * n
+  pw = [ 0 ] * k
+  conn = [ 0 ] * n                    # connection of unplaced vertices to placed ones
+  heap = [ (-g.vwgt[v], -sum(g.adj[v].itervalues()), v) for v in xrange(n) ]
+  heapq.heapify(heap)
+  while heap:
+    key, _, v = heapq.heappop(heap)
+    if part[v] >= 0 or (key < 0 and -key != conn[v] and conn[v]):
+      continue                        # already placed, or stale entry
+    pconn = {}
+    for u, w in g.adj[v].iteritems():
+      if part[u] >= 0:
+        pconn[part[u]] = pconn.get(part[u], 0) + w
+    fits = [ p for p in xrange(k) if pw[p] + g.vwgt[v] <= caps[p] ]
+    if fits:
+      # most connected, then the one with most room left
+      p = max(fits, key = lambda p: (pconn.get(p, 0), caps[p] - pw[p]))
+    else:
+      p = max(xrange(k), key = lambda p: caps[p] - pw[p])
+    part[v] = p
+    pw[p] += g.vwgt[v]
+    for u, w in g.adj[v].iteritems():
+      if part[u] < 0:
+        conn[u] += w
+        heapq.heappush(heap, (-conn[u], 0, u))
+  return part
+
+
+def refine(g, part, caps):
+  """Greedily move vertices to the part they're most connected to, or swap them with a vertex
+     in that part if it is full, until no move improves the cut"""
+  n, k = len(g.vwgt), len(caps)
+  pw = [ 0 ] * k
+  members = [ set() for p in xrange(k) ]
+  for v in xrange(n):
+    pw[part[v]] += g.vwgt[v]
+    members[part[v]].add(v)
+  # conn[v][p]: weight of the edges from v into part p, kept up to date by move()
+  conn = [ [ 0 ] * k for v in xrange(n) ]
+  for v in xrange(n):
+    cv = conn[v]
+    for u, w in g.adj[v].iteritems():
+      cv[part[u]] += w
+
+  def move(v, p):
+    old = part[v]
+    members[old].remove(v)
+    pw[old] -= g.vwgt[v]
+    part[v] = p
+    members[p].add(v)
+    pw[p] += g.vwgt[v]
+    for u, w in g.adj[v].iteritems():
+      cu = conn[u]
+      cu[old] -= w
+      cu[p] += w
+
+  for i in xrange(PASSES):
+    improved = False
+    for v in xrange(n):
+      cur = part[v]
+      cv = conn[v]
+      internal = cv[cur]
+      candidates = sorted([ (c - internal, p) for p, c in enumerate(cv) if p != cur and c > internal ], reverse = True)
+      for gain, p in candidates:
+        if pw[p] + g.vwgt[v] <= caps[p]:
+          move(v, p)
+          improved = True
+          break
+        # part is full: swap with one of the SWAP_CANDIDATES members that gain most from moving to our part
+        adjv = g.adj[v]
+        others = heapq.nlargest(SWAP_CANDIDATES, members[p], key = lambda u: conn[u][cur] - conn[u][p])
+        best, bestgain = None, 0
+        for u in others:
+          if pw[cur] - g.vwgt[v] + g.vwgt[u] > caps[cur] or pw[p] - g.vwgt[u] + g.vwgt[v] > caps[p]:
+            continue
+          ugain = gain + conn[u][cur] - conn[u][p] - 2 * adjv.get(u, 0)
+          if ugain > bestgain:
+            best, bestgain = u, ugain
+        if best is not None:
+          move(best, cur)
+          move(v, p)
+          improved = True
+          break
+    if not improved:
+      break
+
+
+def partition(g, caps, rnd):
+  """Multilevel partitioning of <g> into len(caps) parts, the weight of part p at most caps[p]"""
+  k = len(caps)
+  if k == 1:
+    return [ 0 ] * len(g.vwgt)
+  levels = []
+  cur = g
+  maxvw = max(1, min(caps) / 3)
+  while len(cur.vwgt) > COARSEN_TO * k:
+    coarse, cmap = coarsen(cur, maxvw, rnd)
+    if len(coarse.vwgt) > 0.9 * len(cur.vwgt):
+      break
+    levels.append((cur, cmap))
+    cur = coarse
+  part = initial(cur, caps)
+  refine(cur, part, caps)
+  for fine, cmap in reversed(levels):
+    part = [ part[cmap[v]] for v in xrange(len(fine.vwgt)) ]
+    refine(fine, part, caps)
+  return part
+
+
+
+class Domain:
+
+  def __init__(self, level, key):
+    self.level = level
+    self.key = key
+    self.cpus = []
+    self.children = []
+    self.cores = 0                    # physical cores, set by buildDomains()
+
+
+def readTopology(spec):
+  """Returns (levels, rows, aliases) where rows are [ cpu, value per level ... ] sorted by cpu,
+     and aliases maps levels that were dropped because they didn't split their parent to that parent"""
+  if spec and re.match(r'^\d+x\d+x\d+$', spec):
+    sockets, cores, smt = map(int, spec.split('x'))
+    header = [ 'CPU', 'Core', 'Socket', 'L3', 'L2' ]
+    lines = []
+    for t in xrange(smt):
+      for s in xrange(sockets):
+        for c in xrange(cores):
+          lines.append([ t * sockets * cores + s * cores + c, s * cores + c, s, s, s * cores + c ])
+  else:
+    if spec:
+      text = file(spec).read()
+    else:
+      text = subprocess.Popen(['lscpu', '-p'], stdout = subprocess.PIPE).communicate()[0]
+    header = None
+    lines = []
+    for line in text.splitlines():
+      if line.startswith('#'):
+        if line[1:].strip().startswith('CPU'):
+          header = line[1:].strip().replace(':', ',').split(',')
+      elif line.strip():
+        lines.append(line.strip().replace(':', ',').split(','))
+    if not header:
+      raise ValueError("No '# CPU,Core,...' header in topology %s" % spec)
+  levels = [ l for l in LEVELS if l in header ]
+  columns = [ header.index(l) for l in ['CPU'] + levels ]
+  rows = sorted([ [ int(line[0]) ] + [ line[c] for c in columns[1:] ] for line in lines ])
+  # drop levels that don't split their parent domain
+  keep = []
+  aliases = {}
+  for i, l in enumerate(levels):
+    parents = {}
+    for row in rows:
+      parents.setdefault(tuple([ row[j + 1] for j in keep ]), set()).add(row[i + 1])
+    if max(map(len, parents.values())) > 1:
+      keep.append(i)
+    else:
+      aliases[l] = keep and levels[keep[-1]] or 'Machine'
+  return [ levels[i] for i in keep ], [ [ row[0] ] + [ row[i + 1] for i in keep ] for row in rows ], aliases
+
+
+def buildDomains(levels, rows):
+  root = Domain('Machine', ())
+  domains = { (): root }
+  for row in rows:
+    cpu = row[0]
+    key = ()
+    root.cpus.append(cpu)
+    for i, l in enumerate(levels + ['CPU']):
+      parent = domains[key]
+      if l == 'CPU':
+        key = key + (cpu,)
+      else:
+        key = key + (row[i + 1],)
+      if key not in domains:
+        domains[key] = Domain(l, key)
+        parent.children.append(domains[key])
+      domains[key].cpus.append(cpu)
+  return root
+
+
+def countCores(domain, corelevel):
+  # <corelevel>: Core, or the level it was dropped in favour of (L2 with a private L2 per core);
+  # without a Core column every CPU is a core
+  if domain.level == corelevel or not domain.children:
+    domain.cores = 1
+  else:
+    domain.cores = sum([ countCores(c, corelevel) for c in domain.children ])
+  return domain.cores
+
+
+def place(g, vertices, domain, cpu, rnd):
+  """Place <vertices> of <g> onto the CPUs of <domain>, sets cpu[v]"""
+  if not domain.children:
+    for v in vertices:
+      cpu[v] = domain.cpus[0]
+    return
+  if len(domain.children) == 1:
+    return place(g, vertices, domain.children[0], cpu, rnd)
+  sub = g.subgraph(vertices)
+  total = sum(sub.vwgt)
+  if total <= domain.cores:
+    # room for everyone on a core of their own: each child can take as many nodes as it has cores
+    caps = [ c.cores for c in domain.children ]
+  else:
+    # nodes will share cores (or CPUs): each child takes its share, so SMT siblings are only used when all cores are
+    caps = [ int(total * (1 + imbalance) * len(c.cpus) / len(domain.cpus)) + max(sub.vwgt) for c in domain.children ]
+    if total <= len(domain.cpus):
+      caps = [ min(cap, len(c.cpus)) for cap, c in zip(caps, domain.children) ]
+  part = partition(sub, caps, rnd)
+  for p, child in enumerate(domain.children):
+    place(g, [ v for i, v in enumerate(vertices) if part[i] == p ], child, cpu, rnd)
+
+
+def crossBytes(g, cpu, cpukey, levels):
+  """Bytes communicated between nodes in different domains, per level"""
+  cross = [ 0 ] * len(levels)
+  for v in xrange(len(g.vwgt)):
+    for u, w in g.adj[v].iteritems():
+      if u < v:
+        for i in xrange(len(levels)):
+          if cpukey[cpu[u]][:i + 1] != cpukey[cpu[v]][:i + 1]:
+            cross[i] += w
+  return cross
+
+
+def cpuList(cpus):
+  """taskset -c syntax: 0-3,8"""
+  cpus = sorted(cpus)
+  ranges = []
+  for c in cpus:
+    if ranges and ranges[-1][1] == c - 1:
+      ranges[-1][1] = c
+    else:
+      ranges.append([c, c])
+  return ','.join([ a == b and '%u' % a or '%u-%u' % (a, b) for a, b in ranges ])
+
+
+def nodeKey(name):
+  # sort numeric parts of node names numerically: 2:1 before 10:0
+  return [ (not s.isdigit(), s.isdigit() and int(s) or 0, s) for s in name.split(':') ]
+
+
+def readMatrix(filename):
+  """(from, to, bytes) rows of a CSV or CSR communication matrix"""
+  if filename.endswith('.csr') or filename.endswith('.csr.gz'):
+    names, rowptr, src, bytes = binstore.csrload(filename)
+    # 64-bit counts: array 'L' is only 32-bit on ia32
+    rowptr, src, bytes = struct.unpack('<%uQ' % (len(rowptr) / 8), rowptr), array.array('I', src), struct.unpack('<%uQ' % (len(bytes) / 8), bytes)
+    for dst in xrange(len(names)):
+      for e in xrange(rowptr[dst], rowptr[dst + 1]):
+        yield names[src[e]], names[dst], bytes[e]
+    return
+  for row in csv.reader(filename == '-' and sys.stdin or file(filename)):
+    if len(row) < 3: continue
+    yield row[0], row[1], long(row[2])
+
+
+try:
+  opts, args = getopt.getopt(sys.argv[1:], "hi:o:t:",
+    ["help", "input=", "output=", "topology=", "threads", "bind=", "imbalance=", "seed="])
+except getopt.GetoptError, e:
+  sys.stderr.write("Incorrect option: %s\n" % e)
+  usage()
+  sys.exit(2)
+for o, a in opts:
+  if o in ("-h", "--help"):
+    usage()
+    sys.exit()
+  if o in ("-i", "--input"):
+    filein = a
+  if o in ("-o", "--output"):
+    fileout = a
+  if o in ("-t", "--topology"):
+    topology = a
+  if o == "--threads":
+    bythread = True
+  if o == "--bind":
+    bind = a
+  if o == "--imbalance":
+    imbalance = float(a)
+  if o == "--seed":
+    seed = int(a)
+
+
+g = Graph()
+nodes = {}
+for frname, toname, bw in readMatrix(filein):
+  if bythread:
+    frname, toname = frname.split(':')[0], toname.split(':')[0]
+  for name in (frname, toname):
+    if name not in nodes:
+      nodes[name] = g.addVertex()
+  g.addEdge(nodes[frname], nodes[toname], bw)
+names = sorted(nodes.keys(), key = nodeKey)
+
+levels, rows, aliases = readTopology(topology)
+root = buildDomains(levels, rows)
+countCores(root, aliases.get('Core', 'Core'))
+cpukey = dict([ (row[0], tuple(row[1:]) + (row[0],)) for row in rows ])
+levels.append('CPU')
+bind = aliases.get(bind, bind)
+if bind not in levels + ['Machine']:
+  raise ValueError("Invalid --bind %s, topology has levels %s" % (bind, ', '.join(levels)))
+
+rnd = random.Random(seed)
+cpu = [ None ] * len(g.vwgt)
+place(g, [ nodes[name] for name in names ], root, cpu, rnd)
+
+# baseline: nodes in name order on CPUs in number order
+linear = [ None ] * len(g.vwgt)
+for i, name in enumerate(names):
+  linear[nodes[name]] = root.cpus[i * len(root.cpus) / len(names)]
+
+total = sum([ sum(a.values()) for a in g.adj ]) / 2
+sys.stderr.write("%u nodes, %u CPUs, %u bytes communicated between nodes\n" % (len(names), len(root.cpus), total))
+for level, mapped, base in zip(levels, crossBytes(g, cpu, cpukey, levels), crossBytes(g, linear, cpukey, levels)):
+  sys.stderr.write("  across %-6s %14u bytes (%5.1f%%), linear mapping %14u bytes (%5.1f%%)\n"
+    % (level, mapped, 100. * mapped / (total or 1), base, 100. * base / (total or 1)))
+
+# bind to all CPUs of the node's domain at level <bind>
+depth = (['Machine'] + levels).index(bind)
+domaincpus = {}
+for c in root.cpus:
+  domaincpus.setdefault(cpukey[c][:depth], []).append(c)
+out = fileout == '-' and sys.stdout or file(fileout, 'w')
+for name in names:
+  out.write("%s\t%s\n" % (name, cpuList(domaincpus[cpukey[cpu[nodes[name]]][:depth]])))
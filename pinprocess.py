@@ -1,10 +1,18 @@
 #!/usr/bin/python
 # $Id: pinprocess.py 6447 2010-05-18 06:47:40Z wheirman $
 
-import sys, dicts, getopt, mrange, binstore, csv
+import sys, os, dicts, getopt, mrange, binstore, csv, spill, tempfile, shutil, array, itertools, struct
 from libcompat import *
 
 THREADS = 256
+SPILL_ENTRY_BYTES = 256   # rough size of one buffered --membudget tuple
+SPILL_CHECK = 4096        # records between --membudget checks of the comm matrix size
+SAVE_VERSION = 2          # version of the --save file format
+SAVE_RECORDS = ('START', 'STOP', 'V', 'D', 'L', 'U', 'B')  # records --save copies as they are
+NUMA_POLICY_THRESHOLD = 0.8  # fraction of an allocation site's bytes that must be local for a NUMA policy to be suggested
+SYNC_KINDS = ('lock', 'cond', 'barrier', 'futex')  # sync object kinds in 'B' records
+CACHE_COUNTS = 4          # per-pair counts in a 'K' record: coherence, capacity, cold misses, invalidations
+FOREVER = sys.maxint      # --membudget: time of rows whose source is resolved to the function it is finally collapsed into
 
 
 class StackRecord:
@@ -20,12 +28,23 @@ class StackRecord:
     self.region = parent and parent.region or 0
     self.depth = parent and parent.depth + 1 or 1
     self.traceOutput = False          # did we output an E record yet?
-    self.name = groupName(self.tid, self.fid, self.dfid, self.region, self.icountStart)
-    names[self.id] = self.name
+    if tfview:
+      self.name = tfview.groupName(self.tid, self.fid, self.dfid, self.region, self.icountStart)
+      if not membudget:
+        names[self.id] = self.name
+      else:
+        nametable.add((self.id, tick(), 'N', self.name))
     if doobjects:
       self.ocommr = dicts.DDict(long)   # communication from objects to this function, <object>: <bytecount> dictionary
       self.ocommw = dicts.DDict(long)   # communication from this function to objects, <object>: <bytecount> dictionary
-    allFuncs[(tid, dfid)] = self
+    if keepfuncs:
+      allFuncs[(tid, dfid)] = self
+    if saved:
+      # --save: the call tree is written as T records, numbered in order, that refer to their parent's number
+      global nodenum
+      nodenum += 1
+      self.node = nodenum
+      saved.store('T', tid, fid, dfid, icount or 0, parent and parent.node or 0)
 
   def printTrace(self):
     if not self.traceOutput:
@@ -43,9 +62,9 @@ class StackRecord:
   def printIDs(self):
     global functions, sites
     # if we didn't already, output function description
-    if self.fid in functions:
+    if self.fid in functions and self.fid not in printed:
       #print ('F', self.fid, functions[self.fid])
-      del functions[self.fid]
+      printed[self.fid] = True
     # if we didn't already, output call site description
     if self.site in sites:
       #print ('A', self.site, sites[self.site])
@@ -53,13 +72,14 @@ class StackRecord:
 
   def commClean(self):
     # clean up communication matrix: collapse and remove communication to self
-    if comm[self.id]:
-      for f, bw in comm[self.id].items():
+    # (with --membudget, View.resolve() does this once the whole trace has been read)
+    if tfview.comm[self.id] and not membudget:
+      for f, bw in tfview.comm[self.id].items():
         if f in collapsed:
-          comm[self.id][findNonCollapsedParent(f)] += bw
-          del comm[self.id][f]
-      if self.id in comm[self.id]:
-        del comm[self.id][self.id]
+          tfview.comm[self.id][findNonCollapsedParent(f)] += bw
+          del tfview.comm[self.id][f]
+      if self.id in tfview.comm[self.id]:
+        del tfview.comm[self.id][self.id]
     if doobjects:
       for o in self.ocommr.keys():
         o.printTrace()
@@ -67,9 +87,15 @@ class StackRecord:
         o.printTrace()
 
   def collapse(self):
-    collapsed[self.id] = self.parent.id
-    for f, bw in comm[self.id].items():
-      comm[self.parent.id][f] += bw
+    if membudget:
+      nametable.add((self.id, tick(), 'C', self.parent.id))
+    else:
+      collapsed[self.id] = self.parent.id
+    for f, bw in tfview.comm[self.id].items():
+      tfview.comm[self.parent.id][f] += bw
+    if membudget:
+      for key, n in tfview.extra.pop(self.id, {}).items():
+        tfview.extra[self.parent.id][key] += n
     if doobjects:
       for o, bw in self.ocommr.items():
         self.parent.ocommr[o] += bw
@@ -78,7 +104,7 @@ class StackRecord:
 
   def exit(self, icount, isCollapsed):
     # if isCollapsed: PinComm trace won't refer to us, we don't need to be remembered
-    if isCollapsed and self.dfid:
+    if isCollapsed and self.dfid and keepfuncs:
       del allFuncs[(self.tid, self.dfid)]
     # compute icount
     if icount:
@@ -92,28 +118,35 @@ class StackRecord:
       self.parent.icountLast = self.icountLast
 
     # when measuring communication between (dynamic) functions: don't keep all comm entries but process them when the function ends
-    if groupby == 'tf':
+    if tfview:
       # clean up communication matrix
       self.commClean()
       # small functions: collaps into parent
       if self.parent and \
           (   self.icount is None       # not started yet \
            or self.icount < minlen      # short instruction count \
-           or (sum(comm[self.id].values()) - comm[self.id].get(self.id, 0) - comm[self.id].get(self.parent.id, 0) < mincomm) \
+           or (sum(tfview.comm[self.id].values()) - tfview.comm[self.id].get(self.id, 0) - tfview.comm[self.id].get(self.parent.id, 0) < mincomm) \
                                         # low communication \
            or self.fid in libfunctions and self.parent.fid in libfunctions and not insidelibs \
                                         # inside a library function \
           ):
         self.collapse()
       else:
-        if started and (mincomm == 0 or comm[self.id]):
+        if started and (mincomm == 0 or tfview.comm[self.id]):
           self.printTrace()
         # write out all communication info for this function
         # "C" <thread id> <dynamic function id> \
         #   <communication-to-other-(thread,function)s (not including children)> <instruction count (including children)>
-        if comm[self.id]:
-          for f, bw in sorted(comm[self.id].items()):
-            out.writerow([names[f], self.name, bw])
+        if tfview.comm[self.id] and membudget:
+          t = tick()
+          for f, bw in tfview.comm[self.id].items():
+            tfview.rows.add((f, t, self.id, self.name, bw))
+        elif tfview.comm[self.id]:
+          for f, bw in sorted(tfview.comm[self.id].items()):
+            tfview.out.writerow([names[f], self.name, bw])
+        if membudget and self.id in tfview.extra:
+          for (f, kind, key), n in tfview.extra.pop(self.id).items():
+            tfview.extrarows.add((f, FOREVER, self.id, self.name, kind, key, n))
         if doobjects:
           if self.ocommr:
             pass#print ('OR', self.tid, self.dfid, [ (o.oid, bw) for o, bw in sorted(self.ocommr.items()) ])
@@ -123,14 +156,11 @@ class StackRecord:
       if self.traceOutput:
         pass#print ('X', tid, self.dfid, self.icount or 0)
 
-      del comm[self.id]
+      del tfview.comm[self.id]
       if doobjects:
         del self.ocommr
         del self.ocommw
 
-    if not self.parent or self.parent.region != self.region:
-      regions[self.region].exit(self.tid, self.icountLast)
-
 
 def findNonCollapsedParent(f):
   while f in collapsed:
@@ -138,6 +168,38 @@ def findNonCollapsedParent(f):
   return f
 
 
+def regionNode(tid, dfid):
+  # the function a C, O, H or K record refers to, a placeholder if it isn't known (any more)
+  try:
+    return allFuncs[(tid, dfid)]
+  except KeyError:
+    return StackRecord(tid, 0, dfid, 0)
+
+
+def tick():
+  global clock
+  clock += 1
+  return clock
+
+def nextItem(iterator):
+  try:
+    return iterator.next()
+  except StopIteration:
+    return None
+
+
+
+class SavedNode:
+  # a function of the call tree in a --save file, when there is no --groupby tf view that needs its StackRecord
+  __slots__ = ('tid', 'fid', 'dfid', 'icountStart')
+
+  def __init__(self, tid, fid, dfid, icount):
+    self.tid = tid
+    self.fid = fid
+    self.dfid = dfid
+    self.icountStart = icount
+
+
 
 class Object(mrange.Range):
 
@@ -189,6 +251,74 @@ class Region:
 
 
 
+class Interval:
+  # communication matrix of one -interval period, from 'V' records
+
+  def __init__(self, seq):
+    self.seq = seq
+    self.icount = 0
+    self.comm = dicts.DDict(long)     # (from, to): bytes
+
+  def add(self, icount, entries):
+    self.icount = icount
+    for tid, regionid, _tid, _regionid, size in entries:
+      frid, toid = intervalNodeName(_tid, _regionid), intervalNodeName(tid, regionid)
+      if frid != toid:
+        self.comm[(frid, toid)] += size
+
+  def finish(self):
+    phase = phases.classify(self)
+    for (frid, toid), bw in sorted(self.comm.items()):
+      iout.writerow([self.seq, self.icount, phase, frid, toid, bw])
+
+
+
+class Phases:
+  # online (leader) clustering of intervals: an interval joins the phase whose mean normalized matrix
+  # is closest (L1 distance, 0..2) if that distance is below <threshold>, else it starts a new phase.
+  # phase 0 collects intervals without any communication
+
+  def __init__(self, threshold):
+    self.threshold = threshold
+    self.centroids = []               # per phase: [ number of intervals, (from, to): mean fraction ]
+    self.comm = dicts.DDict(long)     # (phase, from, to): bytes
+    self.intervals = dicts.DDict(int) # phase: number of intervals
+    self.first = {}                   # phase: icount at the end of its first interval
+
+  def classify(self, interval):
+    total = float(sum(interval.comm.values()))
+    if not total:
+      phase = 0
+    else:
+      vector = dict([ (k, bw / total) for k, bw in interval.comm.items() ])
+      best, bestdist = None, None
+      for i, (n, centroid) in enumerate(self.centroids):
+        dist = sum([ abs(vector.get(k, 0) - v) for k, v in centroid.items() ]) \
+             + sum([ v for k, v in vector.items() if k not in centroid ])
+        if bestdist is None or dist < bestdist:
+          best, bestdist = i, dist
+      if best is not None and bestdist < self.threshold:
+        n, centroid = self.centroids[best]
+        for k in set(centroid.keys()) | set(vector.keys()):
+          centroid[k] = (centroid.get(k, 0) * n + vector.get(k, 0)) / (n + 1)
+        self.centroids[best][0] = n + 1
+      else:
+        best = len(self.centroids)
+        self.centroids.append([1, vector])
+      phase = best + 1
+    self.intervals[phase] += 1
+    self.first.setdefault(phase, interval.icount)
+    for (frid, toid), bw in interval.comm.items():
+      self.comm[(phase, frid, toid)] += bw
+    return phase
+
+  def write(self, filename):
+    pout = csv.writer(file(filename, 'w'))
+    for (phase, frid, toid), bw in sorted(self.comm.items()):
+      pout.writerow([phase, self.intervals[phase], self.first[phase], frid, toid, bw])
+
+
+
 class MemSize:
 
   def __init__(self, gid):
@@ -231,25 +361,64 @@ class MemSize:
     return '<MemSize(%s): %d, %d, %d>' % (self.gid, self.memnow, self.memmax, self.memmax_tot)
 
 
+class NumaSite:
+  # -numa: page placement and accesses of one allocation site (or of memory outside any allocation)
+
+  def __init__(self):
+    self.pages = {}                       # page address: None
+    self.bytes = 0L
+    self.local = 0L                       # bytes accessed from the node that touched the page first
+    self.pagebest = 0L                    # sum over pages of the bytes accessed from the node using the page most
+    self.nodes = dicts.DDict(long)        # node: bytes accessed from it
+
+  def add(self, page, firstnode, pagenodes):
+    self.pages[page] = None
+    for node, bytes in pagenodes.items():
+      self.bytes += bytes
+      self.nodes[node] += bytes
+      if node == firstnode:
+        self.local += bytes
+    self.pagebest += max(pagenodes.values())
+
+  def policy(self):
+    # first touch already puts the pages where they are used
+    if self.local >= NUMA_POLICY_THRESHOLD * self.bytes:
+      return 'first-touch'
+    # one node does (nearly) all accesses
+    node, bytes = max(self.nodes.items(), key = lambda n: n[1])
+    if bytes >= NUMA_POLICY_THRESHOLD * self.bytes:
+      return 'bind:%u' % node
+    # each page is used by one node, but not by the one that touched it first: initialize in parallel
+    if self.pagebest >= NUMA_POLICY_THRESHOLD * self.bytes:
+      return 'parallel-init'
+    return 'interleave'
+
+
 functions = {}
 libfunctions = {}
 sites = {}
+sitenames = {}                            # call site: 'file:line', kept after sites entries are output
+funcnames = {}                            # static function id: name, kept after functions entries are output
+hotloads = []                             # -hotloads: (pc, function, file:line, bytes, loads, misses)
+falseshare = []                           # -falseshare lines: (address, false sharing transfers, true sharing transfers, object, writers)
+numaregions = dicts.DDict(lambda: [ 0L ] * 4)   # -numa: merged region: [bytes read, bytes written, remote bytes read, remote bytes written]
+numasites = dicts.DDict(NumaSite)               # -numa: object name: NumaSite
+syncobjects = dicts.DDict(lambda: [ None, 0L, 0L, 0L, 0L ])  # -sync: address: [kind, acquires, handoffs, sync bytes, data bytes]
+printed = {}                              # static function ids whose F record printIDs() output
 names = {}
-rnames = {}
 funcid = [ None for t in xrange(THREADS) ]# current function <dfid> per thread
-groups = [ None for t in xrange(THREADS) ]# current groupid per thread
 allFuncs = {}
 icounts = [ 0 for t in xrange(THREADS) ]  # last icount per thread
 oidnum = 0
 stack = [ [] for t in xrange(THREADS) ]   # call stack per thread (list of StackRecord objects)
 memory = {}                               # (group id (StackRecord.id or aggregate) of last writer to this memory address, dict of all readers that have this location cached)
-objects = mrange.RangeDictO(depth = 5, width = 10, size = 1024*1024)
+objects = binstore.rangemap()             # live objects by address range
 collapsed = {}                            # collapsed[<child>] = <parent> when <child> was short and has been collapsed into <parent>, both StackRecord.id
-comm = dicts.DDict(dicts.DDict, long)     # communication between entities
 regions = dicts.DDict(Region, init_with_key = True)
-mallocs = {}
+mallocs = binstore.rangemap()             # malloc()ed ranges: (group id, size)
 memsize = dicts.DDict(MemSize, init_with_key = True)
 started = False                           # True once we reach the START record
+clock = 0                                 # --membudget: sequence number of name, collapse and output events
 
 
 minlen = 0          # minumum length of function (#instructions, including children) for it not to be collapsed into its parent
@@ -257,12 +426,26 @@ mincomm = 0         # minumum communication of function (bytes read) for it not
 doobjects = False
 insidelibs = False  # if False, collapse all library functions onto the first library call; if True, keep all functions providing a look inside library calls
 ignorelibs = []     # patterns to ignore as library functions
-groupby = 'tf'
-groupby_icount = 0
+modes = []          # --groupby modes, each one is a View
 regionmerge = 'r'
 mallocmerge = 'r'
 filein = "pincommtrace.pcs"
 fileout = "-"
+fileobjects = "pincommobjects.csv"
+fileintervals = "pincommintervals.csv"
+filephases = "pincommphases.csv"
+filelatency = "pincommlatency.csv"
+filecache = "pincommcache.csv"
+filefalseshare = "pincommfalseshare.csv"
+filehotloads = "pincommhotloads.csv"
+filenuma = "pincommnuma.csv"
+filenumasites = "pincommnumasites.csv"
+numanode = 't % 2'
+filesync = "pincommsync.csv"
+phasethreshold = 0.5
+membudget = 0       # MB of communication and function tables to keep in memory before spilling to sorted runs, 0 = no limit
+filecsr = None      # --csrout: write the communication matrix as binary CSR to this file instead of CSV
+filesave = None     # --save: write the call tree and the communication tables keyed by its nodes to this file
 
 
 def usage():
@@ -270,16 +453,51 @@ def usage():
 -i --input    input filename, default is stdin
 -o --output   output filename, default is stdout
 --minlen      minimum length of functions (#instructions) for functions not to be collapsed into their parent
+--csrout      write the communication matrix in binary CSR form (see README) to this file instead of CSV,
+              gzip-compressed if the name ends in .gz
 --objects     enable counting communication per object (malloc range)
+--objout      output filename for communication per object (traces made with -objects), default is pincommobjects.csv
 --insidelibs  provide view inside library functions, default = collapse each library call and its children into a single node
 --ignorelibs  pattern to ignore as library function
---groupby     group functions by: tf (thread, (dynamic) function) [default],
+--groupby     group functions by (several modes, comma-separated or repeated, are processed in one pass,
+              each to its own <output>.<mode>.csv): tf (thread, (dynamic) function) [default],
                                   ts (thread, static function),
                                   s  (static function),
                                   tr (thread, region),
                                   r  (region),
                                   t  (thread)
                                   tt:icount  (thread+time, icount = icount (total over all threads) to group time by)
+--latout      output filename for write-to-read distance histograms (traces made with -latency), default is pincommlatency.csv
+              rows are: from, to, minimum distance, maximum distance (instructions), bytes
+--cacheout    output filename for the cache model's misses (traces made with -cache), default is pincommcache.csv
+              rows are: from, to, coherence misses, capacity misses, cold misses, invalidations
+              (misses are of reads in `to' of data last written in `from', invalidations are of lines held by `to'
+              caused by writes in `from')
+--hotout      output filename for the load instructions reading most communicated data (traces made with -hotloads), default is pincommhotloads.csv
+              rows are: file:line, function, instruction address, bytes, loads, misses
+--falseout    output filename for the cache lines with most false sharing (traces made with -falseshare), default is pincommfalseshare.csv
+              rows are: line address, false sharing transfers, true sharing transfers, allocation, functions that wrote the line
+--numanode    python expression mapping thread `t' to the NUMA node it runs on, for traces made with -numa, default is t % 2
+--numaout     output filename for the NUMA accesses per region (traces made with -numa), default is pincommnuma.csv
+              rows are: region, bytes read, bytes written, remote bytes read, remote bytes written, remote fraction
+              (remote: the page was touched first by a thread on another node)
+--numasiteout output filename for the NUMA placement per allocation site (traces made with -numa), default is pincommnumasites.csv
+              rows are: allocation, pages, bytes, local fraction, bytes per node (node:bytes ...), suggested policy
+              (first-touch, bind:<node>, parallel-init (each page is used by one node, touch it there first) or interleave)
+--syncout     output filename for the per sync object counts (traces made with -sync), default is pincommsync.csv
+              rows are: address, kind (lock, cond, barrier, futex), acquires, handoffs (acquires by another thread than
+              the previous one), bytes of its own traffic, bytes of communication it ordered, ordered bytes per acquire
+--intervalout output filename for the per-interval time series (traces made with -interval), default is pincommintervals.csv
+              rows are: interval, icount, phase, from, to, bytes
+--phaseout    output filename for the communication per phase, default is pincommphases.csv
+              rows are: phase, number of intervals, icount at end of first interval, from, to, bytes
+--phasethreshold  maximum L1 distance (0..2) between normalized matrices of intervals in the same phase, default is 0.5
+--membudget   keep at most this many MB of communication and function tables in memory, spill the rest to sorted
+              runs in $TMPDIR and merge them at the end, default is no limit
+--save        write the call tree (one node per function with its icounts, as they are after resolving S, J and
+              I records) and the communication tables keyed by (tree node, region) to this file, which can be
+              passed to -i again to re-apply --minlen, --mincomm, --insidelibs, --groupby or --regionmerge
+              much faster than reading the raw trace
 --regionmerge python expression forming a mapping function from regionid `r' to a region identifier, making it possible to merge regions
 --mallocmerge same as --regionmerge, but applied on merged regions and only for malloc() counts
 """
@@ -288,7 +506,8 @@ def usage():
 try:
   opts, args = getopt.getopt(sys.argv[1:], "ho:i:",
     ["help", "output=", "input=", "minlen=", "mincomm=", "objects", "insidelibs", "ignorelibs=",
-     "groupby=", "regionmerge=", "mallocmerge="])
+     "groupby=", "regionmerge=", "mallocmerge=", "objout=",
+     "intervalout=", "phaseout=", "phasethreshold=", "latout=", "cacheout=", "falseout=", "hotout=", "numanode=", "numaout=", "numasiteout=", "syncout=", "membudget=", "save=", "csrout="])
 except getopt.GetoptError, e:
   # print help information and exit:
   sys.stderr.write("Incorrect option: %s\n" % e)
@@ -308,67 +527,455 @@ for o, a in opts:
     mincomm = long(a)
   if o == "--objects":
     doobjects = True
+  if o == "--objout":
+    fileobjects = a
   if o == "--insidelibs":
     insidelibs = True
   if o == "--ignorelibs":
     ignorelibs.append(a)
   if o == "--groupby":
-    if ':' in a:
-      a, groupby_icount = a.split(':')
-      groupby_icount = long(groupby_icount)
-    groupby = a
+    modes += a.split(',')
   if o == "--regionmerge":
     regionmerge = a
   if o == "--mallocmerge":
     mallocmerge = a
+  if o == "--hotout":
+    filehotloads = a
+  if o == "--falseout":
+    filefalseshare = a
+  if o == "--numanode":
+    numanode = a
+  if o == "--numaout":
+    filenuma = a
+  if o == "--numasiteout":
+    filenumasites = a
+  if o == "--syncout":
+    filesync = a
+  if o == "--latout":
+    filelatency = a
+  if o == "--cacheout":
+    filecache = a
+  if o == "--intervalout":
+    fileintervals = a
+  if o == "--phaseout":
+    filephases = a
+  if o == "--phasethreshold":
+    phasethreshold = float(a)
+  if o == "--membudget":
+    membudget = float(a)
+  if o == "--save":
+    filesave = a
+  if o == "--csrout":
+    filecsr = a
 
 regionmerge = eval("lambda r: int(" + regionmerge + ")")
 mallocmerge = eval("lambda r: int(" + mallocmerge + ")")
+numanode = eval("lambda t: int(" + numanode + ")")
+if not modes:
+  modes = ['tf']
+
+def function_name(fid, hideprinted = False):
+  # tf names don't show the functions whose F record printIDs() already output
+  if hideprinted and fid in printed:
+    fid = None
+  return ':'.join(map(str, functions.get(fid, ['??','??','',0])))
 
 
-def function_name(fid):
-  return ':'.join(map(str, functions.get(fid, ['??','??','',0])))
+class CSRWriter:
+  # --csrout: takes the rows a csv.writer would get, numbers the node names and writes the matrix at close()
 
-# generate __setGroupId(tid) function.
-if groupby == 'tf':
-  __groupId = lambda tid, fid, dfid, region, icounts: (tid, dfid)
-  groupName = lambda tid, fid, dfid, region, icounts: '%u:%s:%u' % (tid, function_name(fid), dfid)
-elif groupby == 'ts':
-  __groupId = lambda tid, fid, dfid, region, icounts: (tid, fid)
-  groupName = lambda tid, fid, dfid, region, icounts: '%u:%s' % (tid, function_name(fid))
-elif groupby == 's':
-  __groupId = lambda tid, fid, dfid, region, icounts: (0, fid)
-  groupName = lambda tid, fid, dfid, region, icounts: function_name(fid)
-elif groupby == 'tr':
-  __groupId = lambda tid, fid, dfid, region, icounts: (tid, region)
-  groupName = lambda tid, fid, dfid, region, icounts: '%u:%u' % (tid, region)
-elif groupby == 'r':
-  __groupId = lambda tid, fid, dfid, region, icounts: (0, region)
-  groupName = lambda tid, fid, dfid, region, icounts: '%u' % (region)
-elif groupby == 't':
-  __groupId = lambda tid, fid, dfid, region, icounts: (tid, 0)
-  groupName = lambda tid, fid, dfid, region, icounts: '%u' % (tid)
-elif groupby == 'tt':
-  __groupId = lambda tid, fid, dfid, region, icounts: (tid, int(icounts / groupby_icount))
-  groupName = lambda tid, fid, dfid, region, icounts: '%u:%u' % (tid, int(icounts / groupby_icount))
-else:
-  raise ValueError("Invalid groupby %s" % groupby)
+  def __init__(self, filename):
+    self.filename = filename
+    self.index = {}
+    self.names = []
+    self.dst = array.array('I')
+    self.src = array.array('I')
+    self.bytes = []                   # packed as 64-bit at close(), array 'L' is only 32-bit on ia32
 
+  def node(self, name):
+    try:
+      return self.index[name]
+    except KeyError:
+      self.index[name] = len(self.names)
+      self.names.append(name)
+      return self.index[name]
+
+  def writerow(self, row):
+    frname, toname, bw = row
+    self.src.append(self.node(frname))
+    self.dst.append(self.node(toname))
+    self.bytes.append(bw)
+
+  def close(self):
+    binstore.csrstore(self.filename, self.names, self.dst, self.src, struct.pack('<%uQ' % len(self.bytes), *self.bytes),
+      self.filename.endswith('.gz'))
+
+
+class View:
+  # one --groupby mode: how functions are grouped, and the communication matrices and output files of those groups
+
+  def __init__(self, mode, fileout, filecsr, fileobjects, filelatency, filecache):
+    self.mode = mode
+    self.groupby, self.icount = mode, 0
+    if ':' in mode:
+      self.groupby, self.icount = mode.split(':')
+      self.icount = long(self.icount)
+    self.fileout = fileout
+    self.filecsr = filecsr
+    self.fileobjects = fileobjects
+    self.filelatency = filelatency
+    self.filecache = filecache
+    self.out = None
+    self.rnames = {}
+    self.groups = [ None for t in xrange(THREADS) ]  # current groupid per thread
+    self.comm = dicts.DDict(dicts.DDict, long)       # communication between entities
+    self.ocomm = dicts.DDict(long)                   # communication between entities per object, (from, to, object name): bytes
+    self.latency = dicts.DDict(long)                 # communication by log2 of write-to-read distance, (from, to, bucket): bytes
+    self.cache = dicts.DDict(long)                   # cache model misses and invalidations, (from, to, kind): count
+    self.extra = dicts.DDict(dicts.DDict, long)      # --membudget with tf: latency and cache counts per destination function,
+                                                     #   (from, 'H', bucket) or (from, 'K', kind): bytes or count
+    # only tf names depend on more than the group id: keep the function of each group id, and whether printIDs()
+    # had output it (leaving it out of the name) when it was last seen.
+    # With --membudget, resolve() looks them up instead
+    self.keepnames = not membudget and self.groupby == 'tf'
+
+    icount = self.icount
+    if self.groupby == 'tf':
+      self.groupId = lambda tid, fid, dfid, region, icounts: (tid, dfid)
+      self.groupName = lambda tid, fid, dfid, region, icounts: '%u:%s:%u' % (tid, function_name(fid, True), dfid)
+      self.gidName = lambda gid: '%u:%s:%u' % (gid[0], function_name(None), gid[1])
+    elif self.groupby == 'ts':
+      self.groupId = lambda tid, fid, dfid, region, icounts: (tid, fid)
+      self.groupName = lambda tid, fid, dfid, region, icounts: '%u:%s' % (tid, function_name(fid))
+      self.gidName = lambda gid: '%u:%s' % (gid[0], function_name(gid[1]))
+    elif self.groupby == 's':
+      self.groupId = lambda tid, fid, dfid, region, icounts: (0, fid)
+      self.groupName = lambda tid, fid, dfid, region, icounts: function_name(fid)
+      self.gidName = lambda gid: function_name(gid[1])
+    elif self.groupby == 'tr':
+      self.groupId = lambda tid, fid, dfid, region, icounts: (tid, region)
+      self.groupName = lambda tid, fid, dfid, region, icounts: '%u:%u' % (tid, region)
+      self.gidName = lambda gid: '%u:%u' % gid
+    elif self.groupby == 'r':
+      self.groupId = lambda tid, fid, dfid, region, icounts: (0, region)
+      self.groupName = lambda tid, fid, dfid, region, icounts: '%u' % (region)
+      self.gidName = lambda gid: '%u' % gid[1]
+    elif self.groupby == 't':
+      self.groupId = lambda tid, fid, dfid, region, icounts: (tid, 0)
+      self.groupName = lambda tid, fid, dfid, region, icounts: '%u' % (tid)
+      self.gidName = lambda gid: '%u' % gid[0]
+    elif self.groupby == 'tt':
+      self.groupId = lambda tid, fid, dfid, region, icounts: (tid, int(icounts / icount))
+      self.groupName = lambda tid, fid, dfid, region, icounts: '%u:%u' % (tid, int(icounts / icount))
+      self.gidName = lambda gid: '%u:%u' % gid
+    else:
+      raise ValueError("Invalid groupby %s" % mode)
+
+  def regionGroupId(self, tid, regionid, dfid):
+    # group id of a region as found in C and O records
+    if not keepfuncs:
+      # --membudget and the group id doesn't depend on the function
+      return self.groupId(tid, 0, dfid, regionid, 0)
+    return self.nodeGroupId(regionNode(tid, dfid), regionid)
+
+  def nodeGroupId(self, e, regionid):
+    # group id of a region of function <e> (a StackRecord, or a SavedNode from a --save file)
+    gid = self.groupId(e.tid, e.fid, e.dfid, regionid, e.icountStart)
+    if self.keepnames:
+      self.rnames[gid] = (e.fid, e.fid in printed)
+    return gid
+
+  def name(self, gid):
+    if self.keepnames:
+      fid, hidden = self.rnames[gid]
+      if hidden:
+        fid = None
+      return '%u:%s:%u' % (gid[0], function_name(fid), gid[1])
+    return self.gidName(gid)
+
+  def addRecord(self, kind, gid, sources):
+    # a C, O, H or K record for destination <gid>, sources are (group id, values of the entry...)
+    if kind == 'C':
+      matrix = self.comm[gid]
+      for src, size in sources:
+        matrix[src] += size
+    elif kind == 'O':
+      for src, objectid, site, size in sources:
+        self.ocomm[(src, gid, objectName(objectid, site))] += size
+    elif kind == 'H':
+      for src, bucket, size in sources:
+        if membudget and self.groupby == 'tf':
+          self.extra[gid][(src, 'H', bucket)] += size
+        else:
+          self.latency[(src, gid, bucket)] += size
+    else:
+      for s in sources:
+        src, counts = s[0], s[1:]
+        for kind, n in enumerate(counts):
+          if n and membudget and self.groupby == 'tf':
+            self.extra[gid][(src, 'K', kind)] += n
+          elif n:
+            self.cache[(src, gid, kind)] += n
+
+  def setGroupId(self, tid):
+    f = funcid[tid]
+    if f:
+      gid = self.groupId(tid, f.fid, f.dfid, f.region, f.icountStart)
+      if self.keepnames:
+        self.rnames[gid] = (f.fid, f.fid in printed)
+      self.groups[tid] = gid
+    else:
+      self.groups[tid] = ('t' in self.groupby and tid or 0, -1)
 
-def makeGroupId(tid):
-  gid = __groupId(tid, funcid[tid].fid, funcid[tid].dfid, funcid[tid].region, funcid[tid].icountStart)
-  rnames[gid] = groupName(tid, funcid[tid].fid, funcid[tid].dfid, funcid[tid].region, funcid[tid].icountStart)
-  return gid
+  def open(self):
+    if self.filecsr:
+      self.out = CSRWriter(self.filecsr)
+    else:
+      self.out = csv.writer(self.fileout == '-' and sys.stdout or file(self.fileout, 'w'))
+    if membudget:
+      # the budget is shared by all views, tf also needs half of its share for the name table
+      # and splits the rest between communication and latency/cache rows
+      share = spillentries / len(views)
+      if self.groupby == 'tf':
+        share /= 4
+        self.extrarows = spill.Runs(spilldir, 'extra', share)
+      self.rows = spill.Runs(spilldir, 'rows-' + self.mode.replace(':', '_'), share)
+
+  def spillComm(self):
+    # --membudget, groupby other than tf: move the aggregated matrix to a sorted run
+    for toid, value in self.comm.items():
+      for frid, bw in value.items():
+        if frid != toid:
+          self.rows.add((toid, frid, bw))
+    self.comm.clear()
+    self.rows.spill()
+
+  def resolve(self, rows):
+    # --membudget with --groupby tf: rows are (source, time, destination, destination name, ...).
+    # Merge them with the (id, time, 'N' name | 'C' parent) table to give each source the name it had at that time,
+    # or replace it by the parent it was collapsed into before then and try again in the next pass.
+    # Returns the resolved rows, (time, source, source name, destination name, ...), sorted by time.
+    pending, resolved, level = rows, spill.Runs(spilldir, 'resolved', rows.maxbuffer), 0
+    while not pending.empty():
+      level += 1
+      collapsing = spill.Runs(spilldir, 'rows%u' % level, rows.maxbuffer)
+      table = nametable.merge()
+      entry = nextItem(table)
+      current, name, parent = None, None, None
+      for row in pending.merge():
+        src, t, dst, dstname = row[:4]
+        if src != current:
+          current, name, parent = src, None, None
+        while entry and (entry[0] < src or entry[0] == src and entry[1] < t):
+          if entry[0] == src:
+            if entry[2] == 'N':
+              name = entry[3]
+            else:
+              parent = entry[3]
+          entry = nextItem(table)
+        if parent:
+          collapsing.add((parent,) + row[1:])
+        elif src != dst:
+          resolved.add((t, src, name or self.groupName(src[0], 0, src[1], 0, 0), dstname) + row[4:])
+      pending.remove()
+      pending = collapsing
+    return resolved
+
+  def resolveComm(self):
+    # communication rows are resolved at the time their destination ended,
+    # so they come out in the same order as without --membudget
+    resolved = self.resolve(self.rows)
+    last, total = None, 0
+    for t, src, name, dstname, bw in resolved.merge():
+      if (t, src) != last and last:
+        self.out.writerow(row + [total])
+        total = 0
+      last, row, total = (t, src), [name, dstname], total + bw
+    if last:
+      self.out.writerow(row + [total])
+    resolved.remove()
+
+  def resolveExtra(self):
+    # latency and cache rows are resolved at the end, like findNonCollapsedParent() does without --membudget,
+    # then summed per pair of names
+    resolved = self.resolve(self.extrarows)
+    named = spill.Runs(spilldir, 'named', self.extrarows.maxbuffer)
+    for t, src, name, dstname, kind, key, n in resolved.merge():
+      named.add((kind, name, dstname, key, n))
+    resolved.remove()
+    lout, kout = None, None
+    for (kind, frname, toname), rows in itertools.groupby(named.merge(), lambda row: row[:3]):
+      sums = dicts.DDict(long)
+      for row in rows:
+        sums[row[3]] += row[4]
+      if kind == 'H':
+        lout = lout or csv.writer(file(self.filelatency, 'w'))
+        for bucket, bw in sorted(sums.items()):
+          # bucket b holds distances in [2^(b-1), 2^b)
+          lout.writerow([frname, toname, bucket and 1L << (bucket - 1) or 0, (1L << bucket) - 1, bw])
+      else:
+        kout = kout or csv.writer(file(self.filecache, 'w'))
+        kout.writerow([frname, toname] + [ sums[k] for k in xrange(CACHE_COUNTS) ])
+    named.remove()
+
+  def spillWrite(self):
+    # --membudget, groupby other than tf: sum the rows of all runs
+    last, total = None, 0
+    for toid, frid, bw in self.rows.merge():
+      if (toid, frid) != last and last:
+        self.out.writerow([self.name(last[1]), self.name(last[0]), total])
+        total = 0
+      last, total = (toid, frid), total + bw
+    if last:
+      self.out.writerow([self.name(last[1]), self.name(last[0]), total])
+    self.rows.remove()
+
+  def write(self):
+    name = self.name
+    if 's' in self.groupby:
+      for (tid, fid) in self.comm.keys():
+        if fid in functions and fid not in printed:
+          print ('F', fid, functions[fid])
+          printed[fid] = True
+      for item in self.comm.values():
+        for (tid, fid) in item.keys():
+          if fid in functions and fid not in printed:
+            print ('F', fid, functions[fid])
+            printed[fid] = True
+
+    if membudget and self.groupby == 'tf':
+      if self.comm or self.extra:
+        sys.stderr.write("--membudget: skipping communication to %u functions that had already ended\n" % len(set(self.comm.keys() + self.extra.keys())))
+      self.comm.clear()
+      self.extra.clear()
+      self.resolveComm()
+      self.resolveExtra()
+    elif membudget:
+      self.spillComm()
+      self.spillWrite()
+
+    for toid, value in self.comm.items():
+      if toid:
+        for frid, bw in sorted(value.items()):
+          if frid != toid:
+            self.out.writerow([name(frid), name(toid), bw])
+    if self.filecsr:
+      self.out.close()
+
+    if doobjects and self.ocomm:
+      oout = csv.writer(file(self.fileobjects, 'w'))
+      for (frid, toid, oname), bw in sorted(self.ocomm.items()):
+        if self.groupby == 'tf':
+          frid, toid = findNonCollapsedParent(frid), findNonCollapsedParent(toid)
+        if frid != toid:
+          oout.writerow([name(frid), name(toid), oname, bw])
+
+    if self.latency:
+      merged = dicts.DDict(long)
+      for (frid, toid, bucket), bw in self.latency.items():
+        if self.groupby == 'tf':
+          frid, toid = findNonCollapsedParent(frid), findNonCollapsedParent(toid)
+        if frid != toid:
+          merged[(name(frid), name(toid), bucket)] += bw
+      lout = csv.writer(file(self.filelatency, 'w'))
+      for (frname, toname, bucket), bw in sorted(merged.items()):
+        # bucket b holds distances in [2^(b-1), 2^b)
+        lout.writerow([frname, toname, bucket and 1L << (bucket - 1) or 0, (1L << bucket) - 1, bw])
+
+    if self.cache:
+      merged = dicts.DDict(lambda: [ 0L ] * CACHE_COUNTS)
+      for (frid, toid, kind), n in self.cache.items():
+        if self.groupby == 'tf':
+          frid, toid = findNonCollapsedParent(frid), findNonCollapsedParent(toid)
+        if frid != toid:
+          merged[(name(frid), name(toid))][kind] += n
+      kout = csv.writer(file(self.filecache, 'w'))
+      for (frname, toname), counts in sorted(merged.items()):
+        kout.writerow([frname, toname] + counts)
+
+
+def viewFileName(filename, mode):
+  # with more than one --groupby, each view writes to <base>.<mode><ext>
+  if len(modes) == 1:
+    return filename
+  base, ext = os.path.splitext(filename)
+  if ext == '.gz':
+    base, ext = os.path.splitext(base)
+    ext += '.gz'
+  return '%s.%s%s' % (base, mode.replace(':', '_'), ext)
+
+if fileout == '-' and len(modes) > 1:
+  fileout = 'pincomm.csv'
+if len(dict.fromkeys(modes)) != len(modes):
+  sys.stderr.write("Each --groupby mode can only be given once\n")
+  sys.exit(2)
+views = [ View(mode, viewFileName(fileout, mode), filecsr and viewFileName(filecsr, mode), viewFileName(fileobjects, mode), viewFileName(filelatency, mode),
+                viewFileName(filecache, mode))
+          for mode in modes ]
+tfview = ([ view for view in views if view.groupby == 'tf' ] + [ None ])[0]
+groups = views[0].groups                  # current groupid per thread, of the first view (for malloc() counts)
+
+# with --membudget, only keep StackRecords of functions that have ended if a group id depends on them
+# (or --save has to refer to them)
+keepfuncs = not membudget or filesave or len([ view for view in views if view.groupby in ('ts', 's', 'tt') ]) > 0
+if membudget:
+  if tfview and (mincomm or doobjects):
+    sys.stderr.write("--membudget with --groupby tf can't be combined with --mincomm or --objects\n")
+    sys.exit(2)
+  spilldir = tempfile.mkdtemp(prefix = 'pinprocess')
+  spillentries = int(membudget * 1024 * 1024 / SPILL_ENTRY_BYTES) + 1
+  if tfview:
+    nametable = spill.Runs(spilldir, 'names', spillentries / len(views) / 2)
+
+
+def objectName(objectid, site):
+  if objectid:
+    return '#%u' % objectid
+  elif site in sitenames:
+    return sitenames[site]
+  else:
+    return '%x' % site
+
+def intervalNodeName(tid, regionid):
+  # V records are kept per (thread, region), only t and r groupby (of the first view) can be honored
+  if views[0].groupby == 't':
+    return '%u' % tid
+  elif views[0].groupby == 'r':
+    return '%u' % regionmerge(regionid)
+  else:
+    return '%u:%u' % (tid, regionmerge(regionid))
 
 def setGroupId(tid):
-  """Update the thread's groupid (groups[tid]),
+  """Update the thread's groupid in each view,
      must be called after each change to funcid[tid] or regions[tid].
   """
-  if funcid[tid]:
-    groups[tid] = makeGroupId(tid)
-  else:
-    groups[tid] = ('t' in groupby and tid or 0, -1)
+  for view in views:
+    view.setGroupId(tid)
+
+
+
+def addFunction(fid, image, name, filename, line):
+  if saved:
+    saved.store('F', fid, image, name, filename, line)
+  functions[fid] = (image, name, filename, line)
+  funcnames[fid] = name
+  if sum([ image.startswith(prefix) for prefix in ('/lib/', '/usr/lib/') ]) and not sum([ image.startswith(prefix) for prefix in ignorelibs ]):
+    libfunctions[fid] = True
 
+def addSite(site, fid, filename, line):
+  if saved:
+    saved.store('A', site, fid, filename, line)
+  sites[site] = (fid, filename, line)
+  sitenames[site] = '%s:%u' % (filename, line)
+
+def loadSymCache(filename, image, base):
+  # F and A records of an image, cached by pincomm -symcache with addresses relative to the image
+  # (function ids and call sites are 32-bit in the trace)
+  for args in binstore.binload(filename):
+    if args[0] == 'F':
+      addFunction(int((base + args[1]) & 0xffffffff), image, *args[2:])
+    elif args[0] == 'A':
+      addSite(int((base + args[1]) & 0xffffffff), int((base + args[2]) & 0xffffffff), *args[3:])
 
 
 def fEnter(tid, fid, dfid, icount, returnIp = None):
@@ -384,6 +991,11 @@ def fEnter(tid, fid, dfid, icount, returnIp = None):
 def fExit(tid, icount = None, isCollapsed = False):
   e = stack[tid].pop()
   e.exit(icount, isCollapsed)
+  if saved:
+    # by now, icountLast includes all I records seen while this function was running
+    saved.store('X', e.node, e.icountLast or 0, isCollapsed and 1 or 0)
+  if not e.parent or e.parent.region != e.region:
+    regions[e.region].exit(tid, e.icountLast)
   if stack[tid]:
     funcid[tid] = stack[tid][-1]
   else:
@@ -391,161 +1003,310 @@ def fExit(tid, icount = None, isCollapsed = False):
   setGroupId(tid)
 
 
-bs_in = binstore.binload(filein)
-# only if opening filein doesn't fail, create output file
-out = csv.writer(fileout == '-' and sys.stdout or file(fileout, 'w'))
-
-for args in bs_in:
-  #if fidnum[0] > 100000:
-  #  print 'done'
-  #  sys.stdin.read()
-  #  sys.exit(0)
-
+def commonRecord(args):
+  # records that are read the same way from a trace and from a --save file, False for any other record
+  global started, iout, interval
   if args[0] == 'START':
     started = True
 
   elif args[0] == 'STOP':
     started = False
 
-  elif args[0] == 'END':
-    break
-
   elif args[0] == 'F':
-    fid = args[1]
-    functions[fid] = args[2:]
-    if sum([ args[2].startswith(prefix) for prefix in ('/lib/', '/usr/lib/') ]) and not sum([ args[2].startswith(prefix) for prefix in ignorelibs ]):
-      libfunctions[fid] = True
+    addFunction(*args[1:])
 
   elif args[0] == 'A':
-    sites[args[1]] = args[2:]
-
-  elif args[0] == 'I':
-    tid, icount = args[1:]
-    icounts[tid] = icount
-    if funcid[tid]:
-      funcid[tid].icountLast = icount
-
-  elif args[0] == 'S':
-    if not started and not doobjects: continue # we only use S records before mallocs (ignored when !doobjects) and just after START
-    tid, fids = args[1], args[2:]
-    for i in xrange(len(fids), len(stack[tid])):
-      fExit(tid)
-    for i, (fid, site) in enumerate(fids[:len(stack[tid])]):
-      if stack[tid][i].fid != fid:
-        for j in xrange(i, len(stack[tid])):
-          fExit(tid)
-        break
-    for fid, site in fids[len(stack[tid]):]:
-      fEnter(tid, fid, 0, site)
-
-  elif args[0] == 'E':
-    tid, fid, dfid, returnIp, icount = args[1:]
-    icounts[tid] = icount
-    fEnter(tid, fid, dfid, icount, returnIp)
-
-  elif args[0] == 'X':
-    tid, icount, isCollapsed = args[1:]
-    icounts[tid] = icount
-    # pop <dfid> from stack
-    if funcid[tid]: # never pull the last item off the stack
-      fExit(tid, icount, isCollapsed)
-
-  elif args[0] == 'J':
-    tid, fid, icount = args[1:]
-    icounts[tid] = icount
-    # look through the stack if we find it
-    for i in xrange(len(stack[tid])-1, -1, -1):
-      if stack[tid][i].fid == fid:
-        for j in xrange(len(stack[tid])-1, i, -1):
-          fExit(tid, icount)
-        break
-    # function was not on the stack, add it now
-    if not stack[tid] or stack[tid][-1].fid != fid:
-      fEnter(tid, fid, icount)
-
-  elif args[0] == 'M':
-    tid, objectid, returnip, addr, size = args[1:]
-    if objectid:
-      gid = (-1, objectid)
-    else:
-      gid = groups[tid]
-      if gid:
-        gid = (gid[0], mallocmerge(gid[1]))
-    if doobjects:
-      objects.appendUnique(Object(objectid, tid, returnip, addr, size))
-    if addr in mallocs:
-      _gid, _size = mallocs[addr]
-      memsize[_gid].free(_size)
-    memsize[gid].malloc(size)
-    mallocs[addr] = (gid, size)
-
-  elif args[0] == 'N':
-    tid, addr = args[1:]
-    if addr in mallocs:
-      _gid, _size = mallocs[addr]
-      memsize[_gid].free(_size)
-      del mallocs[addr]
-    elif addr:
-      print "unknown free", addr, "!!!!"
-
-  elif args[0] == 'C':
-    tid, regionid, dfid, sources = args[1], args[2], args[3], args[4:]
-    try:
-      e = allFuncs[(tid, dfid)]
-    except KeyError:
-      e = StackRecord(tid, 0, dfid, 0)
-    gid = __groupId(tid, e.fid, dfid, regionid, e.icountStart)
-    rnames[gid] = groupName(tid, e.fid, dfid, regionid, e.icountStart)
-    for s in sources:
-      _tid, _regionid, _dfid, size = s
+    addSite(*args[1:])
+
+  elif args[0] == 'D':
+    fid, pc, size, loads, misses, filename, line = args[1:]
+    hotloads.append((pc, funcnames.get(fid, '%x' % fid), '%s:%u' % (filename, line), size, loads, misses))
+
+  elif args[0] == 'L':
+    addr, false, true, objectid, site, writers = args[1], args[2], args[3], args[4], args[5], args[6:]
+    falseshare.append((addr, false, true, objectName(objectid, site), [ funcnames.get(fid, '%x' % fid) for fid in writers ]))
+
+  elif args[0] == 'U':
+    page, first, objectid, site, accesses = args[1], args[2], args[3], args[4], args[5:]
+    firstnode = numanode(first)
+    pagenodes = dicts.DDict(long)
+    for _tid, _regionid, read, written in accesses:
+      node = numanode(_tid)
+      pagenodes[node] += read + written
+      counts = numaregions[regionmerge(_regionid)]
+      counts[0] += read
+      counts[1] += written
+      if node != firstnode:
+        counts[2] += read
+        counts[3] += written
+    numasites[objectName(objectid, site)].add(page, firstnode, pagenodes)
+
+  elif args[0] == 'B':
+    addr, kind, counts = args[1], args[2], args[3:]
+    so = syncobjects[addr]
+    so[0] = SYNC_KINDS[kind]
+    for i, n in enumerate(counts):
+      so[i + 1] += n
+
+  elif args[0] == 'V':
+    seq, icount, entries = args[1], args[2], args[3:]
+    if not iout:
+      iout = csv.writer(file(fileintervals, 'w'))
+    if interval and interval.seq != seq:
+      interval.finish()
+      interval = None
+    if not interval:
+      interval = Interval(seq)
+    interval.add(icount, entries)
+
+  else:
+    return False
+  return True
+
+
+def checkBudget():
+  # --membudget: every SPILL_CHECK C records, move the matrices that outgrew their share to sorted runs
+  global nrecords
+  if membudget:
+    nrecords += 1
+    if nrecords % SPILL_CHECK == 0:
+      for view in views:
+        if view.groupby != 'tf' and sum(map(len, view.comm.values())) > view.rows.maxbuffer:
+          view.spillComm()
+
+
+def readTrace(records):
+  for args in records:
+    #if fidnum[0] > 100000:
+    #  print 'done'
+    #  sys.stdin.read()
+    #  sys.exit(0)
+
+    if saved and args[0] in SAVE_RECORDS:
+      saved.store(*args)
+
+    if commonRecord(args):
+      continue
+
+    if args[0] == 'END':
+      break
+
+    elif args[0] == 'Y':
+      loadSymCache(*args[1:])
+
+    elif args[0] == 'I':
+      tid, icount = args[1:]
+      icounts[tid] = icount
+      if funcid[tid]:
+        funcid[tid].icountLast = icount
+
+    elif args[0] == 'S':
+      if not started and not doobjects: continue # we only use S records before mallocs (ignored when !doobjects) and just after START
+      tid, fids = args[1], args[2:]
+      for i in xrange(len(fids), len(stack[tid])):
+        fExit(tid)
+      for i, (fid, site) in enumerate(fids[:len(stack[tid])]):
+        if stack[tid][i].fid != fid:
+          for j in xrange(i, len(stack[tid])):
+            fExit(tid)
+          break
+      for fid, site in fids[len(stack[tid]):]:
+        fEnter(tid, fid, 0, site)
+
+    elif args[0] == 'E':
+      tid, fid, dfid, returnIp, icount = args[1:]
+      icounts[tid] = icount
+      fEnter(tid, fid, dfid, icount, returnIp)
+
+    elif args[0] == 'X':
+      tid, icount, isCollapsed = args[1:]
+      icounts[tid] = icount
+      # pop <dfid> from stack
+      if funcid[tid]: # never pull the last item off the stack
+        fExit(tid, icount, isCollapsed)
+
+    elif args[0] == 'J':
+      tid, fid, icount = args[1:]
+      icounts[tid] = icount
+      # look through the stack if we find it
+      for i in xrange(len(stack[tid])-1, -1, -1):
+        if stack[tid][i].fid == fid:
+          for j in xrange(len(stack[tid])-1, i, -1):
+            fExit(tid, icount)
+          break
+      # function was not on the stack, add it now
+      if not stack[tid] or stack[tid][-1].fid != fid:
+        fEnter(tid, fid, icount)
+
+    elif args[0] == 'M':
+      tid, objectid, returnip, addr, size = args[1:]
+      if objectid:
+        gid = (-1, objectid)
+      else:
+        gid = groups[tid]
+        if gid:
+          gid = (gid[0], mallocmerge(gid[1]))
+      if not size: continue
+      if doobjects:
+        objects.insert(addr, addr + size, Object(objectid, tid, returnip, addr, size))
+      # blocks overlapping the new one must have been freed without us noticing
+      for _addr, _end, (_gid, _size) in mallocs.insert(addr, addr + size, (gid, size)):
+        memsize[_gid].free(_size)
+      memsize[gid].malloc(size)
+
+    elif args[0] == 'N':
+      tid, addr = args[1:]
       try:
-        _e = allFuncs[(_tid, _dfid)]
+        _gid, _size = mallocs.remove(addr)
+        memsize[_gid].free(_size)
       except KeyError:
-        _e = StackRecord(_tid, 0, _dfid, 0)
-      _gid = __groupId(_tid, _e.fid, _e.dfid, _regionid, _e.icountStart)
-      rnames[_gid] = groupName(_tid, _e.fid, _e.dfid, _regionid, _e.icountStart)
-      comm[gid][_gid] += size
-
-  elif args[0] == 'G':
-    tid, regionid, icount = args[1:]
-    icounts[tid] = icount
-    regionid = regionmerge(regionid)
-    if funcid[tid] and funcid[tid].region != regionid:
-      funcid[tid].region = regionid
-      regions[regionid].enter(tid, icount)
-      setGroupId(tid)
-
-  elif args[0] == 'T':
-    pass
+        if addr:
+          print "unknown free", addr, "!!!!"
+
+    elif args[0] in ('C', 'O', 'H', 'K'):
+      if args[0] == 'O' and not doobjects: continue
+      tid, regionid, dfid, sources = args[1], args[2], args[3], args[4:]
+      if saved:
+        # a --save file refers to the nodes of the call tree, resolved the same way as the views do below
+        saved.store(args[0], regionNode(tid, dfid).node, regionid, *[ (regionNode(s[0], s[2]).node, s[1]) + tuple(s[3:]) for s in sources ])
+      for view in views:
+        view.addRecord(args[0], view.regionGroupId(tid, regionid, dfid), [ (view.regionGroupId(s[0], s[1], s[2]),) + tuple(s[3:]) for s in sources ])
+      if args[0] == 'C':
+        checkBudget()
+
+    elif args[0] == 'G':
+      tid, regionid, icount = args[1:]
+      icounts[tid] = icount
+      regionid = regionmerge(regionid)
+      if funcid[tid] and funcid[tid].region != regionid:
+        funcid[tid].region = regionid
+        regions[regionid].enter(tid, icount)
+        setGroupId(tid)
+
+    elif args[0] in ('T', 'P'):
+      pass
 
-  else:
-    raise ValueError("unknown command:", args)
+    else:
+      raise ValueError("unknown command:", args)
+
+
+def readSaved(records):
+  # a --save file holds the call tree, as T records in the order functions started and X records in the order
+  # they ended, and the C, O, H and K tables with their regions resolved to tree nodes: the views only have
+  # to group them, --groupby tf collapses the tree as it is read
+  nodes = [ None ]                        # node number: its StackRecord with --groupby tf, else a SavedNode
+  for args in records:
+    if args[0] == 'T':
+      tid, fid, dfid, icount, parent = args[1:]
+      if tfview:
+        e = StackRecord(tid, fid, dfid, icount, None, nodes[parent])
+        # like setGroupId() as the function starts
+        if tfview.keepnames:
+          tfview.nodeGroupId(e, e.region)
+      else:
+        e = SavedNode(tid, fid, dfid, icount)
+      nodes.append(e)
+
+    elif args[0] == 'X':
+      if tfview:
+        node, icount, isCollapsed = args[1:]
+        e = nodes[node]
+        e.exit(icount, isCollapsed)
+        if e.parent and tfview.keepnames:
+          tfview.nodeGroupId(e.parent, e.parent.region)
+
+    elif args[0] in ('C', 'O', 'H', 'K'):
+      if args[0] == 'O' and not doobjects: continue
+      node, regionid, sources = args[1], args[2], args[3:]
+      for view in views:
+        view.addRecord(args[0], view.nodeGroupId(nodes[node], regionid), [ (view.nodeGroupId(nodes[s[0]], s[1]),) + tuple(s[2:]) for s in sources ])
+      if args[0] == 'C':
+        checkBudget()
+
+    elif args[0] == 'SAVED':
+      version, savedobjects = args[1:]
+      if version != SAVE_VERSION:
+        raise ValueError("%s was saved by another version of pinprocess.py" % filein)
+      if doobjects and not savedobjects:
+        sys.stderr.write("%s was saved without --objects, there will be no per-object communication\n" % filein)
+
+    elif args[0] == 'END':
+      break
+
+    elif not commonRecord(args):
+      raise ValueError("unknown command:", args)
+
+
+saved = None
+nodenum = 0                               # --save: T records written
+records = binstore.binload(filein)
+first = nextItem(records)
+if first:
+  records = itertools.chain([ first ], records)
+if first and first[0] == 'SAVED' and filesave:
+  sys.stderr.write("%s is a --save file already\n" % filein)
+  sys.exit(2)
+# only if opening filein doesn't fail, create output files
+for view in views:
+  view.open()
+if filesave:
+  saved = binstore.binstore(filesave)
+  saved.store('SAVED', SAVE_VERSION, int(doobjects))
+iout = None                               # -interval time series, opened at the first V record
+interval = None                           # Interval being read, finished when a V record with another seq arrives
+nrecords = 0                              # --membudget: C records since the start
+phases = Phases(phasethreshold)
+
+if first and first[0] == 'SAVED':
+  readSaved(records)
+else:
+  readTrace(records)
 
 
 for tid in xrange(THREADS):
   while stack[tid]:
     fExit(tid)
-
-
-if 's' in groupby:
-  for (tid, fid) in comm.keys():
-    if fid in functions:
-      print ('F', fid, functions[fid])
-      del functions[fid]
-  for item in comm.values():
-    for (tid, fid) in item.keys():
-      if fid in functions:
-        print ('F', fid, functions[fid])
-        del functions[fid]
-
-for toid, value in comm.items():
-  if toid:
-    for frid, bw in sorted(comm[toid].items()):
-      if frid != toid:
-        out.writerow([rnames[frid], rnames[toid], bw])
+saved = None                              # closes the --save file
+
+if interval:
+  interval.finish()
+  phases.write(filephases)
+
+
+for view in views:
+  view.write()
+if membudget and tfview:
+  nametable.remove()
+
+if hotloads:
+  hout = csv.writer(file(filehotloads, 'w'))
+  for pc, fname, location, size, loads, misses in sorted(hotloads, key = lambda h: -h[3]):
+    hout.writerow([location, fname, '%x' % pc, size, loads, misses])
+
+if falseshare:
+  fout = csv.writer(file(filefalseshare, 'w'))
+  for addr, false, true, oname, writers in sorted(falseshare, key = lambda l: -l[1]):
+    fout.writerow(['%x' % addr, false, true, oname, ' '.join(writers)])
+
+if numaregions:
+  nout = csv.writer(file(filenuma, 'w'))
+  for regionid, (read, written, rread, rwritten) in sorted(numaregions.items()):
+    nout.writerow([regionid, read, written, rread, rwritten, '%.3f' % ((rread + rwritten) / float(read + written or 1))])
+  sout = csv.writer(file(filenumasites, 'w'))
+  for oname, ns in sorted(numasites.items(), key = lambda n: -n[1].bytes):
+    sout.writerow([oname, len(ns.pages), ns.bytes, '%.3f' % (ns.local / float(ns.bytes or 1)),
+                   ' '.join([ '%u:%u' % n for n in sorted(ns.nodes.items()) ]), ns.policy()])
+
+if syncobjects:
+  yout = csv.writer(file(filesync, 'w'))
+  for addr, (kind, acquires, handoffs, syncbytes, databytes) in sorted(syncobjects.items(), key = lambda y: -y[1][4]):
+    yout.writerow(['%x' % addr, kind, acquires, handoffs, syncbytes, databytes, '%.1f' % (databytes / float(acquires or 1))])
 
 for rid, region in regions.items():
   region.printTrace()
 
 for gid, ms in memsize.items():
   ms.printTrace()
+
+if membudget:
+  shutil.rmtree(spilldir)
@@ -0,0 +1,212 @@
+/* $Id$ */
+
+/* Single-producer single-consumer rings in a shared memory file (usually under /dev/shm), one per
+   application thread, used by pincomm -shmring to hand memory accesses to the pincommring analyzer.
+   Every event is stamped with the time stamp counter of the pushing thread, which costs no shared cache line,
+   and the analyzer replays the rings in time stamp order. This assumes an invariant TSC that is synchronized
+   across cores, as on all current x86 processors. */
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#define SHMRING_MAGIC 0x524d4350  /* "PCMR" */
+#define SHMRING_LINE 64
+
+/* how a producer waits for room in its ring (back-pressure); the pintool uses PIN_Yield() */
+#ifndef SHMRING_YIELD
+#define SHMRING_YIELD() sched_yield()
+#endif
+
+/* x86 keeps stores in order, only the compiler has to be stopped from reordering */
+#define SHMRING_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+enum { SHMRING_READ = 1, SHMRING_WRITE = 2 };
+
+typedef struct {
+  uint64_t clock;               /* time stamp counter when it was pushed */
+  uint64_t addr;
+  uint64_t region;              /* region of the accessing thread */
+  uint32_t size;
+  uint32_t type;                /* SHMRING_READ or SHMRING_WRITE */
+} SHMRING_EVENT;
+
+typedef struct {
+  volatile uint64_t head;       /* events pushed, only written by the producer */
+  volatile uint64_t pending;    /* while the producer is pushing: a lower bound on the clock of its event, else 0 */
+  uint64_t last;                /* clock of the last event pushed */
+  char pad0[SHMRING_LINE - 3 * sizeof(uint64_t)];
+  volatile uint64_t tail;       /* events popped, only written by the consumer */
+  char pad1[SHMRING_LINE - sizeof(uint64_t)];
+} SHMRING_RING;                 /* followed by <entries> events */
+
+typedef struct {
+  volatile uint32_t magic;      /* set last by the creator */
+  uint32_t nrings;
+  uint64_t entries;             /* per ring, a power of two */
+  volatile uint32_t attached;   /* set by the producer once it has filled in memgran_bits */
+  volatile uint32_t done;       /* set by the producer when it has pushed its last event */
+  uint32_t memgran_bits;
+  char pad0[SHMRING_LINE - 4 * sizeof(uint32_t) - sizeof(uint64_t)];
+} SHMRING_HEADER;
+
+typedef struct {
+  SHMRING_HEADER * hdr;
+  size_t size;
+} SHMRING;
+
+
+static inline uint64_t shmring_clock(void)
+{
+  uint32_t lo, hi;
+  /* not executed before earlier instructions, and later loads don't pass it */
+  __asm__ __volatile__("lfence; rdtsc; lfence" : "=a"(lo), "=d"(hi) :: "memory");
+  return (uint64_t)hi << 32 | lo;
+}
+
+static inline size_t shmring_ringsize(uint64_t entries)
+{
+  return sizeof(SHMRING_RING) + entries * sizeof(SHMRING_EVENT);
+}
+
+static inline SHMRING_RING * shmring_ring(SHMRING * sr, uint32_t ring)
+{
+  return (SHMRING_RING *)((char *)sr->hdr + sizeof(SHMRING_HEADER) + ring * shmring_ringsize(sr->hdr->entries));
+}
+
+static inline SHMRING_EVENT * shmring_events(SHMRING_RING * r)
+{
+  return (SHMRING_EVENT *)(r + 1);
+}
+
+
+static inline SHMRING * shmring_map(int fd, size_t size)
+{
+  SHMRING * sr;
+  void * p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return NULL;
+  sr = (SHMRING *)malloc(sizeof(SHMRING));
+  sr->hdr = (SHMRING_HEADER *)p;
+  sr->size = size;
+  return sr;
+}
+
+/* consumer: create <filename> with <nrings> rings of <entries> (a power of two) events each */
+static inline SHMRING * shmring_create(const char * filename, uint32_t nrings, uint64_t entries)
+{
+  size_t size = sizeof(SHMRING_HEADER) + nrings * shmring_ringsize(entries);
+  SHMRING * sr;
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate(fd, size)) {
+    close(fd);
+    return NULL;
+  }
+  if (!(sr = shmring_map(fd, size)))
+    return NULL;
+  /* the file is zero-filled, so all rings start empty */
+  sr->hdr->nrings = nrings;
+  sr->hdr->entries = entries;
+  SHMRING_BARRIER();
+  sr->hdr->magic = SHMRING_MAGIC;
+  return sr;
+}
+
+/* producer: attach to the rings in <filename>, NULL if it doesn't exist (yet) */
+static inline SHMRING * shmring_open(const char * filename)
+{
+  SHMRING_HEADER hdr;
+  int fd = open(filename, O_RDWR);
+  if (fd < 0)
+    return NULL;
+  if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != SHMRING_MAGIC) {
+    close(fd);
+    return NULL;
+  }
+  return shmring_map(fd, sizeof(SHMRING_HEADER) + hdr.nrings * shmring_ringsize(hdr.entries));
+}
+
+static inline void shmring_close(SHMRING * sr)
+{
+  munmap(sr->hdr, sr->size);
+  free(sr);
+}
+
+
+/* producer: append an event to <ring>, waiting while it is full */
+static inline void shmring_push(SHMRING * sr, uint32_t ring, uint64_t addr, uint32_t size, uint32_t type, uint64_t region)
+{
+  SHMRING_RING * r = shmring_ring(sr, ring);
+  uint64_t head = r->head;
+  SHMRING_EVENT * e;
+  while(head - r->tail >= sr->hdr->entries)
+    SHMRING_YIELD();
+  e = &shmring_events(r)[head & (sr->hdr->entries - 1)];
+  /* announce the push before reading the clock, so shmring_watermark() either sees (pending) or was called
+     before the clock was read; a locked exchange keeps the store from being passed by the read, a plain store
+     would not. Only do so once there is room: while (pending) is set the consumer holds back all events
+     stamped after it, for as long as this thread stays descheduled in between */
+  __sync_lock_test_and_set(&r->pending, r->last ? r->last : 1);
+  e->clock = r->last = shmring_clock();
+  e->addr = addr;
+  e->region = region;
+  e->size = size;
+  e->type = type;
+  SHMRING_BARRIER();
+  r->head = head + 1;
+  SHMRING_BARRIER();
+  r->pending = 0;
+}
+
+/* consumer: oldest event in <ring>, NULL if it is empty */
+static inline SHMRING_EVENT * shmring_peek(SHMRING * sr, uint32_t ring)
+{
+  SHMRING_RING * r = shmring_ring(sr, ring);
+  SHMRING_EVENT * e;
+  if (r->head == r->tail)
+    return NULL;
+  SHMRING_BARRIER();
+  e = &shmring_events(r)[r->tail & (sr->hdr->entries - 1)];
+  return e;
+}
+
+/* consumer: all events stamped before the returned clock have been published, or are found by a
+   shmring_peek() after this call */
+static inline uint64_t shmring_watermark(SHMRING * sr)
+{
+  uint64_t watermark = shmring_clock();
+  uint32_t ring;
+  for(ring = 0; ring < sr->hdr->nrings; ++ring) {
+    uint64_t pending = shmring_ring(sr, ring)->pending;
+    if (pending && pending < watermark)
+      watermark = pending;
+  }
+  return watermark;
+}
+
+/* consumer: done with the event returned by shmring_peek() */
+static inline void shmring_pop(SHMRING * sr, uint32_t ring)
+{
+  SHMRING_RING * r = shmring_ring(sr, ring);
+  SHMRING_BARRIER();
+  r->tail = r->tail + 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHMRING_H
@@ -0,0 +1,94 @@
+# $Id$
+
+# Sorted runs of tuples on disk, to process traces that don't fit in memory (pinprocess.py --membudget)
+
+import os, marshal, heapq
+
+FANIN = 32          # runs merged into one while spilling
+
+
+class Runs:
+  """Collects tuples in memory; once more than <maxbuffer> are buffered, they are sorted and written
+     to a new run file in <tmpdir>. merge() yields all tuples (spilled and buffered) in sorted order.
+  """
+
+  def __init__(self, tmpdir, name, maxbuffer):
+    self.tmpdir = tmpdir
+    self.name = name
+    self.maxbuffer = maxbuffer
+    self.buffer = []
+    self.files = []
+    self.levels = []                  # merge level of each run file, never increasing along files
+    self.nfiles = 0                   # run files ever written, for unique names
+
+  def add(self, item):
+    self.buffer.append(item)
+    if len(self.buffer) > self.maxbuffer:
+      self.spill()
+
+  def spill(self):
+    if not self.buffer:
+      return
+    self.buffer.sort()
+    self.files.append(self.write(self.buffer))
+    self.levels.append(0)
+    self.buffer = []
+    # with a small budget, merge() would have to open too many files at once: every FANIN runs of one
+    # level are merged into one run of the next level, so each tuple is rewritten only a few times
+    while self.levels[-FANIN:] == [ self.levels[-1] ] * FANIN:
+      files = self.files[-FANIN:]
+      level = self.levels[-1] + 1
+      del self.files[-FANIN:], self.levels[-FANIN:]
+      self.files.append(self.write(mergeSorted([ readRun(filename) for filename in files ])))
+      self.levels.append(level)
+      for filename in files:
+        os.unlink(filename)
+
+  def write(self, items):
+    filename = os.path.join(self.tmpdir, '%s.%u' % (self.name, self.nfiles))
+    self.nfiles += 1
+    fp = file(filename, 'wb')
+    for item in items:
+      marshal.dump(item, fp)
+    fp.close()
+    return filename
+
+  def empty(self):
+    return not self.buffer and not self.files
+
+  def merge(self):
+    """k-way merge of all runs, can be called more than once"""
+    self.buffer.sort()
+    return mergeSorted([ iter(self.buffer) ] + [ readRun(filename) for filename in self.files ])
+
+  def remove(self):
+    for filename in self.files:
+      os.unlink(filename)
+    self.buffer = []
+    self.files = []
+    self.levels = []
+
+
+def mergeSorted(sources):
+  heap = []
+  for i, source in enumerate(sources):
+    for item in source:
+      heap.append((item, i))
+      break
+  heapq.heapify(heap)
+  while heap:
+    item, i = heap[0]
+    yield item
+    try:
+      heapq.heapreplace(heap, (sources[i].next(), i))
+    except StopIteration:
+      heapq.heappop(heap)
+
+
+def readRun(filename):
+  fp = file(filename, 'rb')
+  try:
+    while True:
+      yield marshal.load(fp)
+  except EOFError:
+    fp.close()